@@ -0,0 +1,335 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+#include "bf16.hpp"
+#include "cpuid.hpp"
+#include "pages.hpp"
+
+// Native BF16 GEMM on AMX tiles: C (M x N, f32) = A (M x K) * B (K x N),
+// all row-major f32 on the host. A and B are converted to bf16 and packed
+// once into 1 KiB tiles: A as 16 rows x 32 k, B in VNNI order as 16 k-pairs
+// x 16 columns x 2. Each 32 x 32 block of C is accumulated in tmm0-3 from
+// two A tiles (tmm4-5) and two B tiles (tmm6-7) per 32-wide k step.
+//
+// Without AMX (or with `allow_amx` false) the same packed tiles are consumed
+// by an AVX512-BF16 vdpbf16ps kernel (scalar without it), so the engine can
+// be tested on CPUs without AMX; results agree up to f32 summation order.
+class AmxBf16Gemm {
+public:
+  static constexpr int64_t TILE_M = 16;
+  static constexpr int64_t TILE_N = 16;
+  static constexpr int64_t TILE_K = 32;
+  static constexpr int64_t TILE_ELEMS = 512;
+  // Columns of C per cache block, so its B panel stays in L2 while every
+  // thread sweeps its rows of A across it.
+  static constexpr int64_t BLOCK_N = 256;
+
+  AmxBf16Gemm(int64_t m, int64_t n, int64_t k, bool allow_amx = true) {
+    amx = allow_amx && is_amxbf16_supported() && request_amx_permission();
+    reshape(m, n, k);
+  }
+
+  // Resizes the packed buffers for another problem; they only ever grow, so
+  // a reused instance stops allocating once it has seen the largest shape.
+  void reshape(int64_t m, int64_t n, int64_t k) {
+    this->m = m;
+    this->n = n;
+    this->k = k;
+    mt = round_up(m, 2 * TILE_M) / TILE_M;
+    nt = round_up(n, 2 * TILE_N) / TILE_N;
+    kt = round_up(k, TILE_K) / TILE_K;
+    a_tiles.resize(std::max<size_t>(a_tiles.size(), mt * kt * TILE_ELEMS));
+    b_tiles.resize(std::max<size_t>(b_tiles.size(), nt * kt * TILE_ELEMS));
+  }
+
+  bool uses_amx() const { return amx; }
+
+  std::string engine_name() const {
+    return amx ? "AMX tiles" : "AVX512-BF16";
+  }
+
+  void pack_a(float const *a) {
+#pragma omp parallel for collapse(2)
+    for (int64_t ti = 0; ti < mt; ti++) {
+      for (int64_t tk = 0; tk < kt; tk++) {
+        pack_a_tile(a, ti, tk);
+      }
+    }
+  }
+
+  // `b` is K x N row-major, or N x K (inner product weights) if
+  // `transposed`.
+  void pack_b(float const *b, bool transposed = false) {
+#pragma omp parallel for collapse(2)
+    for (int64_t tj = 0; tj < nt; tj++) {
+      for (int64_t tk = 0; tk < kt; tk++) {
+        pack_b_tile(b, transposed, tj, tk);
+      }
+    }
+  }
+
+  // Overwrites `c` (M x N row-major) with A * B.
+  void run(float *c) {
+#pragma omp parallel
+    {
+      begin_thread();
+      for (int64_t nb = 0; nb < nt; nb += BLOCK_N / TILE_N) {
+        int64_t nb_end = std::min(nt, nb + BLOCK_N / TILE_N);
+#pragma omp for collapse(2) schedule(static)
+        for (int64_t ti = 0; ti < mt; ti += 2) {
+          for (int64_t tj = nb; tj < nb_end; tj += 2) {
+            block(ti, tj, c);
+          }
+        }
+      }
+      end_thread();
+    }
+  }
+
+  // Single-threaded pack + run for small problems, called between
+  // begin_thread() and end_thread() on the calling thread.
+  void run_serial(float const *a, float const *b, bool transposed, float *c) {
+    for (int64_t tk = 0; tk < kt; tk++) {
+      for (int64_t ti = 0; ti < mt; ti++)
+        pack_a_tile(a, ti, tk);
+      for (int64_t tj = 0; tj < nt; tj++)
+        pack_b_tile(b, transposed, tj, tk);
+    }
+    for (int64_t ti = 0; ti < mt; ti += 2) {
+      for (int64_t tj = 0; tj < nt; tj += 2) {
+        block(ti, tj, c);
+      }
+    }
+  }
+
+  // Loads (and releases) this thread's tile configuration.
+  void begin_thread() const {
+    if (amx)
+      configure_tiles();
+  }
+  void end_thread() const {
+    if (amx)
+      _tile_release();
+  }
+
+private:
+  struct alignas(64) TileConfig {
+    uint8_t palette_id;
+    uint8_t start_row;
+    uint8_t reserved[14];
+    uint16_t colsb[16];
+    uint8_t rows[16];
+  };
+
+  static int64_t round_up(int64_t x, int64_t to) {
+    return (x + to - 1) / to * to;
+  }
+
+  uint16_t *a_tile(int64_t ti, int64_t tk) {
+    return a_tiles.data() + (ti * kt + tk) * TILE_ELEMS;
+  }
+  uint16_t *b_tile(int64_t tj, int64_t tk) {
+    return b_tiles.data() + (tj * kt + tk) * TILE_ELEMS;
+  }
+
+  void pack_a_tile(float const *a, int64_t ti, int64_t tk) {
+    uint16_t *tile = a_tile(ti, tk);
+    for (int64_t r = 0; r < TILE_M; r++) {
+      int64_t row = ti * TILE_M + r;
+      for (int64_t c = 0; c < TILE_K; c++) {
+        int64_t col = tk * TILE_K + c;
+        tile[r * TILE_K + c] =
+            row < m && col < k ? f32_to_bf16(a[row * k + col]) : 0;
+      }
+    }
+  }
+
+  void pack_b_tile(float const *b, bool transposed, int64_t tj, int64_t tk) {
+    uint16_t *tile = b_tile(tj, tk);
+    for (int64_t p = 0; p < TILE_K / 2; p++) {
+      for (int64_t c = 0; c < TILE_N; c++) {
+        int64_t col = tj * TILE_N + c;
+        for (int64_t h = 0; h < 2; h++) {
+          int64_t row = tk * TILE_K + 2 * p + h;
+          float v = 0;
+          if (row < k && col < n)
+            v = transposed ? b[col * k + row] : b[row * n + col];
+          tile[(p * TILE_N + c) * 2 + h] = f32_to_bf16(v);
+        }
+      }
+    }
+  }
+
+  void block(int64_t ti, int64_t tj, float *c) {
+    if (amx)
+      block_amx(ti, tj, c);
+    else
+      block_avx512(ti, tj, c);
+  }
+
+  // Every tile register is 16 rows of 64 bytes.
+  static void configure_tiles() {
+    TileConfig cfg = {};
+    cfg.palette_id = 1;
+    for (int t = 0; t < 8; t++) {
+      cfg.rows[t] = 16;
+      cfg.colsb[t] = 64;
+    }
+    _tile_loadconfig(&cfg);
+  }
+
+  // Copies a 16 x 16 accumulator tile into C, clipped to its bounds.
+  void store_tile(float const *acc, int64_t ti, int64_t tj, float *c) {
+    int64_t rows = std::min<int64_t>(TILE_M, m - ti * TILE_M);
+    int64_t cols = std::min<int64_t>(TILE_N, n - tj * TILE_N);
+    for (int64_t r = 0; r < rows; r++) {
+      std::memcpy(c + (ti * TILE_M + r) * n + tj * TILE_N, acc + r * TILE_N,
+                  cols * sizeof(float));
+    }
+  }
+
+  void block_amx(int64_t ti, int64_t tj, float *c) {
+    _tile_zero(0);
+    _tile_zero(1);
+    _tile_zero(2);
+    _tile_zero(3);
+    for (int64_t tk = 0; tk < kt; tk++) {
+      _tile_loadd(4, a_tile(ti, tk), 64);
+      _tile_loadd(5, a_tile(ti + 1, tk), 64);
+      _tile_loadd(6, b_tile(tj, tk), 64);
+      _tile_loadd(7, b_tile(tj + 1, tk), 64);
+      _tile_dpbf16ps(0, 4, 6);
+      _tile_dpbf16ps(1, 4, 7);
+      _tile_dpbf16ps(2, 5, 6);
+      _tile_dpbf16ps(3, 5, 7);
+    }
+
+    bool inside = (ti + 2) * TILE_M <= m && (tj + 2) * TILE_N <= n;
+    if (inside) {
+      float *base = c + ti * TILE_M * n + tj * TILE_N;
+      _tile_stored(0, base, n * sizeof(float));
+      _tile_stored(1, base + TILE_N, n * sizeof(float));
+      _tile_stored(2, base + TILE_M * n, n * sizeof(float));
+      _tile_stored(3, base + TILE_M * n + TILE_N, n * sizeof(float));
+      return;
+    }
+    alignas(64) float acc[4][TILE_M * TILE_N];
+    _tile_stored(0, acc[0], TILE_N * sizeof(float));
+    _tile_stored(1, acc[1], TILE_N * sizeof(float));
+    _tile_stored(2, acc[2], TILE_N * sizeof(float));
+    _tile_stored(3, acc[3], TILE_N * sizeof(float));
+    for (int64_t i = 0; i < 2; i++) {
+      for (int64_t j = 0; j < 2; j++) {
+        if ((ti + i) * TILE_M < m && (tj + j) * TILE_N < n)
+          store_tile(acc[i * 2 + j], ti + i, tj + j, c);
+      }
+    }
+  }
+
+  // Same tile arithmetic as _tile_dpbf16ps: for every k-pair p, row r of the
+  // A tile is broadcast as one 32-bit pair against row p of the B tile.
+  void block_avx512(int64_t ti, int64_t tj, float *c) {
+    for (int64_t i = 0; i < 2; i++) {
+      for (int64_t j = 0; j < 2; j++) {
+        if ((ti + i) * TILE_M >= m || (tj + j) * TILE_N >= n)
+          continue;
+        alignas(64) float acc[TILE_M * TILE_N];
+#if defined(__AVX512BF16__)
+        __m512 rows[TILE_M];
+        for (int64_t r = 0; r < TILE_M; r++)
+          rows[r] = _mm512_setzero_ps();
+        for (int64_t tk = 0; tk < kt; tk++) {
+          uint16_t const *at = a_tile(ti + i, tk);
+          uint16_t const *bt = b_tile(tj + j, tk);
+          for (int64_t p = 0; p < TILE_K / 2; p++) {
+            __m512bh bv = (__m512bh)_mm512_loadu_si512(bt + p * TILE_N * 2);
+            for (int64_t r = 0; r < TILE_M; r++) {
+              int32_t pair;
+              std::memcpy(&pair, at + r * TILE_K + 2 * p, sizeof(pair));
+              rows[r] = _mm512_dpbf16_ps(
+                  rows[r], (__m512bh)_mm512_set1_epi32(pair), bv);
+            }
+          }
+        }
+        for (int64_t r = 0; r < TILE_M; r++)
+          _mm512_store_ps(acc + r * TILE_N, rows[r]);
+#else
+        std::fill(acc, acc + TILE_M * TILE_N, 0.0f);
+        for (int64_t tk = 0; tk < kt; tk++) {
+          uint16_t const *at = a_tile(ti + i, tk);
+          uint16_t const *bt = b_tile(tj + j, tk);
+          for (int64_t r = 0; r < TILE_M; r++) {
+            for (int64_t p = 0; p < TILE_K / 2; p++) {
+              for (int64_t col = 0; col < TILE_N; col++) {
+                for (int64_t h = 0; h < 2; h++) {
+                  acc[r * TILE_N + col] +=
+                      bf16_to_f32(at[r * TILE_K + 2 * p + h]) *
+                      bf16_to_f32(bt[(p * TILE_N + col) * 2 + h]);
+                }
+              }
+            }
+          }
+        }
+#endif
+        store_tile(acc, ti + i, tj + j, c);
+      }
+    }
+  }
+
+  int64_t m = 0, n = 0, k = 0;
+  int64_t mt = 0, nt = 0, kt = 0;
+  bool amx = false;
+  std::vector<uint16_t, AlignedAllocator<uint16_t>> a_tiles;
+  std::vector<uint16_t, AlignedAllocator<uint16_t>> b_tiles;
+};
+
+// One of a batch of independent GEMMs: C (m x n) = A (m x k) * B (k x n),
+// row-major f32.
+struct GemmProblem {
+  int64_t m, n, k;
+  float const *a;
+  float const *b;
+  float *c;
+};
+
+// Many small GEMMs in one parallel region. Each thread loads its tile
+// configuration once and then packs and multiplies whole problems on its
+// own, reusing per-thread packing buffers, so no problem pays for a fork,
+// a tile reconfiguration or an allocation.
+class AmxBf16BatchedGemm {
+public:
+  explicit AmxBf16BatchedGemm(bool allow_amx = true) {
+    int threads = omp_get_max_threads();
+    for (int t = 0; t < threads; t++)
+      scratch.emplace_back(0, 0, 0, allow_amx);
+  }
+
+  std::string engine_name() const { return scratch[0].engine_name(); }
+
+  void run(std::vector<GemmProblem> const &problems) {
+    int64_t count = problems.size();
+#pragma omp parallel
+    {
+      AmxBf16Gemm &gemm = scratch[omp_get_thread_num()];
+      gemm.begin_thread();
+      // Dynamic so variable shapes balance across threads.
+#pragma omp for schedule(dynamic, 4)
+      for (int64_t i = 0; i < count; i++) {
+        auto const &p = problems[i];
+        gemm.reshape(p.m, p.n, p.k);
+        gemm.run_serial(p.a, p.b, false, p.c);
+      }
+      gemm.end_thread();
+    }
+  }
+
+private:
+  std::vector<AmxBf16Gemm> scratch;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+static inline uint16_t f32_to_bf16(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  if ((u & 0x7fffffff) > 0x7f800000)
+    return (u >> 16) | 0x40;
+  u += 0x7fff + ((u >> 16) & 1);
+  return u >> 16;
+}
+
+// Round-to-nearest-even f32 -> bf16, 32 values per vcvtne2ps2bf16 when the
+// build targets AVX512-BF16.
+static void convert_f32_to_bf16(float const *src, uint16_t *dst, size_t n) {
+  constexpr size_t chunk = 1 << 16;
+  int64_t chunks = (n + chunk - 1) / chunk;
+#pragma omp parallel for
+  for (int64_t c = 0; c < chunks; c++) {
+    size_t i = c * chunk;
+    size_t end = std::min(n, i + chunk);
+#if defined(__AVX512BF16__)
+    for (; i + 32 <= end; i += 32) {
+      __m512 lo = _mm512_loadu_ps(src + i);
+      __m512 hi = _mm512_loadu_ps(src + i + 16);
+      _mm512_storeu_si512(dst + i, (__m512i)_mm512_cvtne2ps_pbh(hi, lo));
+    }
+#endif
+    for (; i < end; i++) {
+      dst[i] = f32_to_bf16(src[i]);
+    }
+  }
+}
+
+static inline float bf16_to_f32(uint16_t h) {
+  uint32_t u = (uint32_t)h << 16;
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
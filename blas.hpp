@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cblas.h>
+#include <cstdint>
+#include <omp.h>
+#include <string>
+
+#include "bf16.hpp"
+
+// OpenBLAS comparison engine. cblas_sbgemm is declared by the OpenBLAS
+// headers but only exported by builds with BUILD_BFLOAT16, so it is bound
+// weakly and checked at runtime.
+#pragma weak cblas_sbgemm
+
+static bool blas_sbgemm_available() { return &cblas_sbgemm != nullptr; }
+
+// Runs OpenBLAS with as many threads as the OpenMP team the other engines
+// use, so GFLOPS are compared at identical thread counts.
+static void blas_set_threads() {
+  openblas_set_num_threads(omp_get_max_threads());
+}
+
+static std::string blas_config() { return openblas_get_config(); }
+
+// C (M x N) = A (M x K) * B, all row-major; `b` is K x N, or N x K (inner
+// product weights) if `transposed`.
+static void blas_sgemm(int64_t m, int64_t n, int64_t k, float const *a,
+                       float const *b, bool transposed, float *c) {
+  cblas_sgemm(CblasRowMajor, CblasNoTrans,
+              transposed ? CblasTrans : CblasNoTrans, m, n, k, 1.0f, a, k, b,
+              transposed ? k : n, 0.0f, c, n);
+}
+
+// Same as blas_sgemm on bf16 inputs (converted with convert_f32_to_bf16),
+// accumulating in f32.
+static void blas_sbgemm(int64_t m, int64_t n, int64_t k, uint16_t const *a,
+                        uint16_t const *b, bool transposed, float *c) {
+  cblas_sbgemm(CblasRowMajor, CblasNoTrans,
+               transposed ? CblasTrans : CblasNoTrans, m, n, k, 1.0f, a, k, b,
+               transposed ? k : n, 0.0f, c, n);
+}
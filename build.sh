@@ -10,6 +10,15 @@ g++ -O3 \
     -march=sapphirerapids \
     -o ${BINARY_DIR}/perf_cpu
 
+g++ -O3 \
+    -std=c++23 \
+    perf_mem.cc \
+    -fomit-frame-pointer \
+    -fopenmp \
+    -lnuma \
+    -march=sapphirerapids \
+    -o ${BINARY_DIR}/perf_mem
+
 g++ -O3 \
     -std=c++23 \
     perf_amx.cc \
@@ -17,6 +26,7 @@ g++ -O3 \
     -fomit-frame-pointer \
     -fopenmp \
     -lopenblas \
+    -lnuma \
     -march=sapphirerapids \
     -mamx-bf16 \
     -o ${BINARY_DIR}/perf_amx
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The data cache hierarchy, both as the kernel reports it in sysfs and as
+// a working-set sweep measures it. Code that needs a cache size should ask
+// here instead of hard-coding one.
+
+struct CacheLevel {
+  int level = 0;
+  // "Data" or "Unified"; instruction caches are skipped.
+  std::string type;
+  size_t bytes = 0;
+};
+
+// "48K", "2048K", "105M" -> bytes.
+static size_t parse_sysfs_size(std::string const &text) {
+  size_t pos = 0;
+  size_t v = 0;
+  try {
+    v = std::stoull(text, &pos);
+  } catch (std::exception const &) {
+    return 0;
+  }
+  switch (pos < text.size() ? text[pos] : ' ') {
+  case 'K':
+    return v << 10;
+  case 'M':
+    return v << 20;
+  case 'G':
+    return v << 30;
+  default:
+    return v;
+  }
+}
+
+// Data and unified caches of `cpu`, innermost first. Empty when sysfs does
+// not describe them (e.g. in some containers).
+static std::vector<CacheLevel> sysfs_caches(int cpu = 0) {
+  std::vector<CacheLevel> levels;
+  std::string base =
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+  for (int i = 0;; i++) {
+    std::string dir = base + std::to_string(i) + "/";
+    std::ifstream level_in(dir + "level");
+    if (!level_in)
+      break;
+    CacheLevel c;
+    std::string size;
+    level_in >> c.level;
+    std::ifstream(dir + "type") >> c.type;
+    std::ifstream(dir + "size") >> size;
+    c.bytes = parse_sysfs_size(size);
+    if (c.type != "Instruction" && c.bytes)
+      levels.push_back(c);
+  }
+  std::sort(levels.begin(), levels.end(),
+            [](auto const &a, auto const &b) { return a.level < b.level; });
+  return levels;
+}
+
+// Size of the level-`level` data cache of cpu 0, 0 if unknown.
+static size_t cache_bytes(int level) {
+  for (auto const &c : sysfs_caches())
+    if (c.level == level)
+      return c.bytes;
+  return 0;
+}
+
+inline std::string format_bytes(double bytes) {
+  static char const *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  int u = 0;
+  while (bytes >= 1024 && u < 4) {
+    bytes /= 1024;
+    u++;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), bytes == std::floor(bytes) ? "%.0f %s"
+                                                             : "%.1f %s",
+                bytes, units[u]);
+  return buf;
+}
+
+// One point of a working-set sweep.
+struct WorkingSetRow {
+  size_t bytes = 0;
+  // Dependent-load latency over a random cycle of the set's cache lines.
+  double latency_ns = 0;
+  // Sequential read bandwidth over the set.
+  double bandwidth_gbs = 0;
+};
+
+// A level inferred from the latency curve: `bytes` is the working set just
+// before the steepest step of the climb to the next plateau, so the real
+// size lies between it and the next size swept. For the outermost level it
+// is simply the largest size swept.
+struct InferredLevel {
+  std::string name;
+  size_t bytes = 0;
+  double latency_ns = 0;
+  double bandwidth_gbs = 0;
+  // From sysfs, 0 if unknown or for DRAM.
+  size_t sysfs_bytes = 0;
+};
+
+// Splits the latency curve at its `levels` largest rises. A rise is a run
+// of consecutive steps that each grow latency by at least `step_min`, taken
+// as a whole so a transition spread over several sizes counts once. Runs
+// are further split after every interior local minimum of the per-step
+// ratio, so two transitions with no flat step between them (L2 -> L3 ->
+// DRAM on a coarse sweep) stay separate, and each rise's boundary is its
+// steepest step. Rises that grow by less than `rise_min` in total (TLB
+// reach, noise) are ignored, as are rises out of a plateau already larger
+// than the last-level cache of `caches`; a plateau past that size is DRAM.
+// `levels` defaults to the number of levels in `caches`.
+inline std::vector<InferredLevel>
+infer_cache_levels(std::vector<WorkingSetRow> rows,
+                   std::vector<CacheLevel> const &caches, int levels = 0,
+                   double step_min = 1.1, double rise_min = 1.5) {
+  std::sort(rows.begin(), rows.end(),
+            [](auto const &a, auto const &b) { return a.bytes < b.bytes; });
+  if (levels <= 0)
+    levels = caches.empty() ? 3 : (int)caches.size();
+  size_t llc = caches.empty() ? 0 : caches.back().bytes;
+
+  // ratio[i] is the growth from rows[i] to rows[i + 1].
+  std::vector<double> ratio;
+  for (size_t i = 0; i + 1 < rows.size(); i++)
+    ratio.push_back(rows[i + 1].latency_ns / rows[i].latency_ns);
+
+  struct Rise {
+    // Row before the steepest step.
+    size_t start = 0;
+    double factor = 1;
+  };
+  std::vector<Rise> rises;
+  auto add_rise = [&](size_t start, size_t end) {
+    double factor = rows[end].latency_ns / rows[start].latency_ns;
+    size_t steepest = start;
+    for (size_t i = start; i < end; i++) {
+      if (ratio[i] > ratio[steepest])
+        steepest = i;
+    }
+    if (factor >= rise_min && (!llc || rows[steepest].bytes <= llc))
+      rises.push_back({steepest, factor});
+  };
+  for (size_t i = 0; i < ratio.size();) {
+    if (ratio[i] < step_min) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    size_t end = i + 1;
+    while (end < ratio.size() && ratio[end] >= step_min) {
+      bool valley = ratio[end] < ratio[end - 1] &&
+                    end + 1 < ratio.size() && ratio[end + 1] >= step_min &&
+                    ratio[end] < ratio[end + 1];
+      end++;
+      if (valley) {
+        add_rise(start, end);
+        start = end;
+      }
+    }
+    if (start < end)
+      add_rise(start, end);
+    i = end;
+  }
+  std::sort(rises.begin(), rises.end(),
+            [](auto const &a, auto const &b) { return a.factor > b.factor; });
+  if ((int)rises.size() > levels)
+    rises.resize(levels);
+  std::sort(rises.begin(), rises.end(),
+            [](auto const &a, auto const &b) { return a.start < b.start; });
+
+  std::vector<InferredLevel> out;
+  for (size_t k = 0; k < rises.size(); k++) {
+    auto const &r = rows[rises[k].start];
+    InferredLevel l;
+    l.name = "L" + std::to_string(k + 1);
+    l.bytes = r.bytes;
+    l.latency_ns = r.latency_ns;
+    l.bandwidth_gbs = r.bandwidth_gbs;
+    if (k < caches.size())
+      l.sysfs_bytes = caches[k].bytes;
+    out.push_back(l);
+  }
+  // The last plateau is memory if every cache level was crossed or it is
+  // larger than the last-level cache.
+  if (!rows.empty()) {
+    auto const &r = rows.back();
+    size_t k = rises.size();
+    bool dram = (int)k == levels || (llc && r.bytes > llc);
+    out.push_back({dram ? "DRAM" : "L" + std::to_string(k + 1), r.bytes,
+                   r.latency_ns, r.bandwidth_gbs,
+                   !dram && k < caches.size() ? caches[k].bytes : 0});
+  }
+  return out;
+}
+
+// The same against the caches sysfs reports for cpu 0.
+inline std::vector<InferredLevel>
+infer_cache_levels(std::vector<WorkingSetRow> rows, int levels = 0,
+                   double step_min = 1.1, double rise_min = 1.5) {
+  return infer_cache_levels(std::move(rows), sysfs_caches(), levels, step_min,
+                            rise_min);
+}
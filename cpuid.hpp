@@ -0,0 +1,20 @@
+#pragma once
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static bool is_amxbf16_supported() {
+  unsigned int eax, ebx, ecx, edx;
+  __asm__ __volatile__("cpuid"
+                       : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                       : "a"(7), "c"(0));
+  return edx & (1 << 22);
+}
+
+// Linux only hands out the AMX tile data state to processes that ask for
+// it; must succeed before the first tile instruction.
+static bool request_amx_permission() {
+  constexpr int ARCH_REQ_XCOMP_PERM = 0x1023;
+  constexpr int XFEATURE_XTILEDATA = 18;
+  return syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA) == 0;
+}
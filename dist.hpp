@@ -1,10 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <immintrin.h>
+#include <omp.h>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "bf16.hpp"
+#include "cache.hpp"
+#include "cpuid.hpp"
 #include "oneapi/dnnl/dnnl.hpp"
+#include "pages.hpp"
+#include "placement.hpp"
+#include "quant.hpp"
+#include "stats.hpp"
 
 #if defined(__GNUC__)
 #define PORTABLE_ALIGN32 __attribute__((aligned(32)))
@@ -14,115 +28,936 @@
 #define PORTABLE_ALIGN64 __declspec(align(64))
 #endif
 
-#define ITERATIONS 10
-
 using tag = dnnl::memory::format_tag;
 using dt = dnnl::memory::data_type;
 
-static bool is_amxbf16_supported() {
-  unsigned int eax, ebx, ecx, edx;
-  __asm__ __volatile__("cpuid"
-                       : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-                       : "a"(7), "c"(0));
-  return edx & (1 << 22);
-}
+// Cache of created primitives keyed on everything that goes into the
+// primitive_desc, so repeated shapes skip primitive_desc creation and JIT.
+// oneDNN fixes the thread count when it creates a primitive, so `get` adds
+// the current one to every key.
+class PrimitiveCache {
+public:
+  struct Entry {
+    dnnl::primitive prim;
+    dnnl::memory::desc src_md;
+    dnnl::memory::desc weights_md;
+    dnnl::memory::desc dst_md;
+  };
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  static std::string key(dnnl::memory::dims const &dims, dt type, tag fmt) {
+    std::string k;
+    for (auto d : dims) {
+      k += std::to_string(d) + "x";
+    }
+    k += ":" + std::to_string(static_cast<int>(type)) + ":" +
+         std::to_string(static_cast<int>(fmt)) + ";";
+    return k;
+  }
+
+  Entry &get(std::string const &key, std::function<Entry()> const &create) {
+    std::string full = key + "t" + std::to_string(omp_get_max_threads()) + ";";
+    auto it = entries.find(full);
+    if (it != entries.end()) {
+      hits++;
+      return it->second;
+    }
+    misses++;
+    return entries.emplace(full, create()).first->second;
+  }
+
+  void clear() { entries.clear(); }
 
-static void write_to_dnnl_memory(void const *handle, dnnl::memory &mem) {
-  dnnl::engine eng = mem.get_engine();
-  int32_t size = mem.get_desc().get_size();
+private:
+  std::unordered_map<std::string, Entry> entries;
+};
+
+struct KernelOptions {
+  // Wrap 64-byte aligned caller buffers in dnnl::memory instead of copying
+  // them when the data type already matches.
+  bool zero_copy = false;
+  // Reorder IP weights once per weight shape and reuse them across batch
+  // sizes instead of reordering on every call.
+  bool packed_weights = false;
+  // Untimed executions before the timed ones.
+  int32_t warmup = 1;
+  SamplingPolicy sampling;
+  // NUMA policy for buffers allocated by the kernels.
+  Placement placement;
+  // Page backing for buffers allocated by the kernels.
+  PageMode pages = PageMode::system;
+  bool debug = false;
+};
+
+static void write_to_dnnl_memory(float const *handle, dnnl::memory &mem) {
   if (!handle)
     throw std::runtime_error("handle is nullptr.");
-  uint8_t *dst = static_cast<uint8_t *>(mem.get_data_handle());
+  void *dst = mem.get_data_handle();
   if (!dst)
     throw std::runtime_error("get_data_handle returned nullptr.");
-  for (int32_t i = 0; i < size; ++i) {
-    dst[i] = ((uint8_t *)handle)[i];
+  auto md = mem.get_desc();
+  switch (md.get_data_type()) {
+  case dt::f32: {
+    size_t size = md.get_size();
+    constexpr size_t chunk = 1 << 22;
+    int64_t chunks = (size + chunk - 1) / chunk;
+#pragma omp parallel for
+    for (int64_t c = 0; c < chunks; c++) {
+      size_t off = c * chunk;
+      std::memcpy(static_cast<uint8_t *>(dst) + off,
+                  reinterpret_cast<uint8_t const *>(handle) + off,
+                  std::min(chunk, size - off));
+    }
+    break;
+  }
+  case dt::bf16:
+    convert_f32_to_bf16(handle, static_cast<uint16_t *>(dst),
+                        md.get_size() / sizeof(uint16_t));
+    break;
+  default:
+    throw std::runtime_error("unsupported destination data type.");
+  }
+}
+
+// dnnl::memory that keeps its backing pages alive when they were not
+// allocated by the library.
+struct OwnedMemory : dnnl::memory {
+  std::shared_ptr<void> storage;
+
+  OwnedMemory() = default;
+  OwnedMemory(dnnl::memory mem, std::shared_ptr<void> storage = nullptr)
+      : dnnl::memory(std::move(mem)), storage(std::move(storage)) {}
+};
+
+// Element `i` of a plain-layout f32, bf16 or s32 memory, as f32.
+static float read_dnnl_value(dnnl::memory const &mem, int64_t i) {
+  void const *p = mem.get_data_handle();
+  switch (mem.get_desc().get_data_type()) {
+  case dt::f32:
+    return static_cast<float const *>(p)[i];
+  case dt::bf16:
+    return bf16_to_f32(static_cast<uint16_t const *>(p)[i]);
+  case dt::s32:
+    return static_cast<int32_t const *>(p)[i];
+  default:
+    throw std::runtime_error("unsupported data type.");
   }
 }
 
-static int64_t amx_matmul(int32_t const &r1, int32_t const &r2, const int32_t &c,
+// Memory for `md` backed per `opts.pages` and placed per `opts.placement`
+// before any page is touched.
+static OwnedMemory new_memory(dnnl::memory::desc const &md,
+                              dnnl::engine &engine,
+                              KernelOptions const &opts) {
+  OwnedMemory mem;
+  if (opts.pages == PageMode::system) {
+    mem = dnnl::memory(md, engine);
+  } else {
+    auto storage = make_pages(md.get_size(), opts.pages);
+    mem = OwnedMemory(dnnl::memory(md, engine, storage.get()), storage);
+  }
+  place_memory(mem.get_data_handle(), md.get_size(), opts.placement);
+  return mem;
+}
+
+// Input memory for `md` backed by `handle` when zero-copy is possible,
+// otherwise a library-owned buffer filled from `handle`.
+static OwnedMemory make_input_memory(dnnl::memory::desc const &md,
+                                      float const *handle,
+                                      dnnl::engine &engine,
+                                      KernelOptions const &opts) {
+  bool aligned =
+      reinterpret_cast<uintptr_t>(handle) % AlignedAllocator<float>::alignment ==
+      0;
+  if (opts.zero_copy && aligned && md.get_data_type() == dt::f32) {
+    return dnnl::memory(md, engine, const_cast<float *>(handle));
+  }
+  auto mem = new_memory(md, engine, opts);
+  write_to_dnnl_memory(handle, mem);
+  return mem;
+}
+
+// Reorders `from` into a new buffer laid out as `to_md`, reusing the cached
+// reorder primitive stored under `key`.
+static OwnedMemory reorder_to(dnnl::memory &from,
+                               dnnl::memory::desc const &to_md,
+                               std::string const &key, dnnl::engine &engine,
+                               dnnl::stream &stream, PrimitiveCache &cache,
+                               KernelOptions const &opts) {
+  auto to = new_memory(to_md, engine, opts);
+  auto &entry = cache.get(key, [&]() {
+    return PrimitiveCache::Entry{dnnl::reorder(from, to), from.get_desc(), {},
+                                 to_md};
+  });
+  entry.prim.execute(stream, {{DNNL_ARG_FROM, from}, {DNNL_ARG_TO, to}});
+  stream.wait();
+  return to;
+}
+
+// Runs `fn` opts.warmup times untimed, then samples its wall time as
+// opts.sampling asks.
+template <typename Fn>
+static LatencyStats time_function(KernelOptions const &opts,
+                                  std::string const &label, Fn &&fn) {
+  for (int32_t i = 0; i < opts.warmup; i++) {
+    fn();
+  }
+  int64_t i = 0;
+  auto samples = collect_samples(opts.sampling, [&]() {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    auto end = std::chrono::high_resolution_clock::now();
+    int64_t diff = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    if (opts.debug) {
+      std::cout << label << ": itr #" << i << " :"  << diff << " ns" << std::endl;
+    }
+    i++;
+    return diff;
+  });
+  return summarize(std::move(samples));
+}
+
+static LatencyStats time_primitive(dnnl::primitive &prim,
+                                   std::unordered_map<int32_t, dnnl::memory> &args,
+                                   dnnl::stream &stream,
+                                   KernelOptions const &opts,
+                                   std::string const &label) {
+  return time_function(opts, label, [&]() {
+    prim.execute(stream, args);
+    stream.wait();
+  });
+}
+
+static LatencyStats amx_matmul(int32_t const &r1, int32_t const &r2, const int32_t &c,
                        const float *a, const float *b, dnnl::engine &engine,
-                       dnnl::stream &stream, bool debug) {
+                       dnnl::stream &stream, PrimitiveCache &cache,
+                       KernelOptions const &opts,
+                       OwnedMemory *dst_out = nullptr) {
   dnnl::memory::dims a_dims = {r1, c};
   dnnl::memory::dims b_dims = {c, r2};
   dnnl::memory::dims c_dims = {r1, r2};
 
-  auto a_md = dnnl::memory::desc(a_dims, dt::bf16, tag::ab);
-  auto b_md = dnnl::memory::desc(b_dims, dt::bf16, tag::ab);
-  auto c_md = dnnl::memory::desc(c_dims, dt::bf16, tag::ab);
-  auto a_mem = dnnl::memory(a_md, engine);
-  auto b_mem = dnnl::memory(b_md, engine);
-  write_to_dnnl_memory(a, a_mem);
-  write_to_dnnl_memory(b, b_mem);
+  std::string key = "matmul;" + PrimitiveCache::key(a_dims, dt::bf16, tag::ab) +
+                    PrimitiveCache::key(b_dims, dt::bf16, tag::ab) +
+                    PrimitiveCache::key(c_dims, dt::bf16, tag::ab);
+  auto &entry = cache.get(key, [&]() {
+    auto a_md = dnnl::memory::desc(a_dims, dt::bf16, tag::ab);
+    auto b_md = dnnl::memory::desc(b_dims, dt::bf16, tag::ab);
+    auto c_md = dnnl::memory::desc(c_dims, dt::bf16, tag::ab);
+    auto pd = dnnl::matmul::primitive_desc(engine, a_md, b_md, c_md);
+    return PrimitiveCache::Entry{dnnl::matmul(pd), pd.src_desc(),
+                                 pd.weights_desc(), pd.dst_desc()};
+  });
 
-  auto pd = dnnl::matmul::primitive_desc(engine, a_md, b_md, c_md);
-  auto c_mem = dnnl::memory(pd.dst_desc(), engine);
+  auto a_mem = make_input_memory(entry.src_md, a, engine, opts);
+  auto b_mem = make_input_memory(entry.weights_md, b, engine, opts);
+  auto c_mem = new_memory(entry.dst_md, engine, opts);
 
-  auto prim = dnnl::matmul(pd);
   std::unordered_map<int32_t, dnnl::memory> args;
   args.insert({DNNL_ARG_SRC, a_mem});
   args.insert({DNNL_ARG_WEIGHTS, b_mem});
   args.insert({DNNL_ARG_DST, c_mem});
 
-  int64_t diff = 0;
-  for (int32_t i = 0; i < ITERATIONS; i++) {
-    auto start = std::chrono::high_resolution_clock::now();
-    prim.execute(stream, args);
-    stream.wait();
-    auto end = std::chrono::high_resolution_clock::now();
-    diff = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    if (debug) {
-      std::cout << "matmul: dims: " << r1 << "," << r2 << "," << c << ": itr #" << i << " :"  << diff << " ns" << std::endl;
-    }
-  }
-  return diff;
+  auto st = time_primitive(entry.prim, args, stream, opts,
+                           "matmul: dims: " + std::to_string(r1) + "," +
+                               std::to_string(r2) + "," + std::to_string(c));
+  if (dst_out)
+    *dst_out = c_mem;
+  return st;
 }
 
-static int64_t amx_inner_product(int32_t const &n, int32_t const &oc,
-                              int32_t const &ic, const float *src, const float *w,
-                              dnnl::engine &engine, dnnl::stream &stream, bool debug) {
+// `batch` uniform r1 x c by c x r2 matmuls in one 3-D primitive; `a`, `b`
+// hold the problems back to back.
+static LatencyStats amx_matmul_batched(int32_t batch, int32_t r1, int32_t r2,
+                                       int32_t c, const float *a,
+                                       const float *b, dnnl::engine &engine,
+                                       dnnl::stream &stream,
+                                       PrimitiveCache &cache,
+                                       KernelOptions const &opts,
+                                       OwnedMemory *dst_out = nullptr) {
+  dnnl::memory::dims a_dims = {batch, r1, c};
+  dnnl::memory::dims b_dims = {batch, c, r2};
+  dnnl::memory::dims c_dims = {batch, r1, r2};
+
+  std::string key = "matmul;" +
+                    PrimitiveCache::key(a_dims, dt::bf16, tag::abc) +
+                    PrimitiveCache::key(b_dims, dt::bf16, tag::abc) +
+                    PrimitiveCache::key(c_dims, dt::f32, tag::abc);
+  auto &entry = cache.get(key, [&]() {
+    auto a_md = dnnl::memory::desc(a_dims, dt::bf16, tag::abc);
+    auto b_md = dnnl::memory::desc(b_dims, dt::bf16, tag::abc);
+    auto c_md = dnnl::memory::desc(c_dims, dt::f32, tag::abc);
+    auto pd = dnnl::matmul::primitive_desc(engine, a_md, b_md, c_md);
+    return PrimitiveCache::Entry{dnnl::matmul(pd), pd.src_desc(),
+                                 pd.weights_desc(), pd.dst_desc()};
+  });
+
+  auto a_mem = make_input_memory(entry.src_md, a, engine, opts);
+  auto b_mem = make_input_memory(entry.weights_md, b, engine, opts);
+  auto c_mem = new_memory(entry.dst_md, engine, opts);
+
+  std::unordered_map<int32_t, dnnl::memory> args;
+  args.insert({DNNL_ARG_SRC, a_mem});
+  args.insert({DNNL_ARG_WEIGHTS, b_mem});
+  args.insert({DNNL_ARG_DST, c_mem});
+
+  auto st = time_primitive(entry.prim, args, stream, opts,
+                           "batched matmul: dims: " + std::to_string(batch) +
+                               "x" + std::to_string(r1) + "," +
+                               std::to_string(r2) + "," + std::to_string(c));
+  if (dst_out)
+    *dst_out = c_mem;
+  return st;
+}
+
+static PrimitiveCache::Entry &ip_primitive(int32_t const &n, int32_t const &oc,
+                                           int32_t const &ic,
+                                           dnnl::engine &engine,
+                                           PrimitiveCache &cache,
+                                           std::string &key) {
   dnnl::memory::dims s_dims = {n, ic};
   dnnl::memory::dims w_dims = {oc, ic};
   dnnl::memory::dims dst_dims = {n, oc};
 
+  auto prop = dnnl::prop_kind::forward_training;
+  key = "ip;" + std::to_string(static_cast<int>(prop)) + ";" +
+        PrimitiveCache::key(s_dims, dt::bf16, tag::any) +
+        PrimitiveCache::key(w_dims, dt::bf16, tag::any) +
+        PrimitiveCache::key(dst_dims, dt::f32, tag::ab);
+  return cache.get(key, [&]() {
+    auto s_md = dnnl::memory::desc(s_dims, dt::bf16, tag::any);
+    auto w_md = dnnl::memory::desc(w_dims, dt::bf16, tag::any);
+    auto dst_md = dnnl::memory::desc(dst_dims, dt::f32, tag::ab);
+    auto pd = dnnl::inner_product_forward::primitive_desc(engine, prop, s_md,
+                                                          w_md, dst_md);
+    return PrimitiveCache::Entry{dnnl::inner_product_forward(pd),
+                                 pd.src_desc(), pd.weights_desc(),
+                                 pd.dst_desc()};
+  });
+}
+
+static LatencyStats amx_inner_product(int32_t const &n, int32_t const &oc,
+                              int32_t const &ic, const float *src, const float *w,
+                              dnnl::engine &engine, dnnl::stream &stream,
+                              PrimitiveCache &cache,
+                              KernelOptions const &opts,
+                              OwnedMemory *dst_out = nullptr) {
+  dnnl::memory::dims s_dims = {n, ic};
+  dnnl::memory::dims w_dims = {oc, ic};
+
   auto s_in_md = dnnl::memory::desc(s_dims, dt::f32, tag::ab);
   auto w_in_md = dnnl::memory::desc(w_dims, dt::f32, tag::ab);
-  auto dst_out_md = dnnl::memory::desc(dst_dims, dt::f32, tag::ab);
-  auto s_in_mem = dnnl::memory(s_in_md, engine);
-  auto w_in_mem = dnnl::memory(w_in_md, engine);
+  auto s_in_mem = make_input_memory(s_in_md, src, engine, opts);
+  auto w_in_mem = make_input_memory(w_in_md, w, engine, opts);
+
+  std::string key;
+  auto &entry = ip_primitive(n, oc, ic, engine, cache, key);
+
+  auto s_mem = reorder_to(s_in_mem, entry.src_md, key + "reorder_src", engine,
+                          stream, cache, opts);
+  auto w_mem = reorder_to(w_in_mem, entry.weights_md, key + "reorder_weights",
+                          engine, stream, cache, opts);
+  auto dst_mem = new_memory(entry.dst_md, engine, opts);
+
+  std::unordered_map<int32_t, dnnl::memory> args;
+  args.insert({DNNL_ARG_SRC, s_mem});
+  args.insert({DNNL_ARG_WEIGHTS, w_mem});
+  args.insert({DNNL_ARG_DST, dst_mem});
+
+  auto st = time_primitive(entry.prim, args, stream, opts,
+                           "ip: dims: " + std::to_string(n) + "," +
+                               std::to_string(oc) + "," + std::to_string(ic));
+  if (dst_out)
+    *dst_out = dst_mem;
+  return st;
+}
+
+// Weights reordered once into the blocked bf16 layout the inner product
+// primitive prefers, so they can be reused across batch sizes.
+struct PackedWeights {
+  OwnedMemory mem;
+  std::string key;
+  int32_t oc = 0;
+  int32_t ic = 0;
+  int64_t reorder_ns = 0;
+};
+
+// `n_hint` is the batch size whose primitive decides the packed layout.
+static PackedWeights pack_ip_weights(int32_t const &n_hint, int32_t const &oc,
+                                     int32_t const &ic, const float *w,
+                                     dnnl::engine &engine, dnnl::stream &stream,
+                                     PrimitiveCache &cache,
+                                     KernelOptions const &opts) {
+  auto w_in_md = dnnl::memory::desc({oc, ic}, dt::f32, tag::ab);
+  auto w_in_mem = make_input_memory(w_in_md, w, engine, opts);
+
+  std::string key;
+  auto &entry = ip_primitive(n_hint, oc, ic, engine, cache, key);
+
+  PackedWeights packed;
+  packed.key = key;
+  packed.oc = oc;
+  packed.ic = ic;
+  auto start = std::chrono::high_resolution_clock::now();
+  packed.mem = reorder_to(w_in_mem, entry.weights_md, key + "reorder_weights",
+                          engine, stream, cache, opts);
+  auto end = std::chrono::high_resolution_clock::now();
+  packed.reorder_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  return packed;
+}
+
+// A primitive with its arguments bound, ready to execute repeatedly.
+struct PreparedPrimitive {
+  dnnl::primitive prim;
+  std::unordered_map<int32_t, dnnl::memory> args;
+  // Keeps memories backed by non-library pages alive.
+  std::vector<OwnedMemory> buffers;
+};
+
+static PreparedPrimitive prepare_inner_product(int32_t const &n,
+                                               const float *src,
+                                               PackedWeights &w,
+                                               dnnl::engine &engine,
+                                               dnnl::stream &stream,
+                                               PrimitiveCache &cache,
+                                               KernelOptions const &opts) {
+  auto s_in_md = dnnl::memory::desc({n, w.ic}, dt::f32, tag::ab);
+  auto s_in_mem = make_input_memory(s_in_md, src, engine, opts);
+
+  std::string key;
+  auto &entry = ip_primitive(n, w.oc, w.ic, engine, cache, key);
 
-  write_to_dnnl_memory(src, s_in_mem);
-  write_to_dnnl_memory(w, w_in_mem);
+  auto s_mem = reorder_to(s_in_mem, entry.src_md, key + "reorder_src", engine,
+                          stream, cache, opts);
+  auto w_mem = w.mem;
+  if (entry.weights_md != w.mem.get_desc()) {
+    // The primitive for this batch size wants another blocking; repack and
+    // charge it to the weights.
+    auto start = std::chrono::high_resolution_clock::now();
+    w_mem = reorder_to(w.mem, entry.weights_md, key + "repack_from;" + w.key,
+                       engine, stream, cache, opts);
+    auto end = std::chrono::high_resolution_clock::now();
+    w.reorder_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+  }
+  auto dst_mem = new_memory(entry.dst_md, engine, opts);
 
-  auto s_md = dnnl::memory::desc(s_dims, dt::bf16, tag::any);
-  auto w_md = dnnl::memory::desc(w_dims, dt::bf16, tag::any);
+  PreparedPrimitive prepared;
+  prepared.prim = entry.prim;
+  prepared.args.insert({DNNL_ARG_SRC, s_mem});
+  prepared.args.insert({DNNL_ARG_WEIGHTS, w_mem});
+  prepared.args.insert({DNNL_ARG_DST, dst_mem});
+  prepared.buffers = {s_mem, w_mem, dst_mem};
+  return prepared;
+}
 
-  auto pd = dnnl::inner_product_forward::primitive_desc(
-      engine, dnnl::prop_kind::forward_training, s_md, w_md, dst_out_md);
-  
-  auto s_mem = dnnl::memory(pd.src_desc(), engine);
-  auto w_mem = dnnl::memory(pd.weights_desc(), engine);
-  auto dst_mem = dnnl::memory(pd.dst_desc(), engine);
+static LatencyStats amx_inner_product(int32_t const &n, const float *src,
+                                 PackedWeights &w, dnnl::engine &engine,
+                                 dnnl::stream &stream, PrimitiveCache &cache,
+                                 KernelOptions const &opts,
+                                 OwnedMemory *dst_out = nullptr) {
+  auto prepared =
+      prepare_inner_product(n, src, w, engine, stream, cache, opts);
+  auto st = time_primitive(prepared.prim, prepared.args, stream, opts,
+                           "ip: dims: " + std::to_string(n) + "," +
+                               std::to_string(w.oc) + "," +
+                               std::to_string(w.ic));
+  if (dst_out)
+    *dst_out = prepared.buffers[2];
+  return st;
+}
 
-  dnnl::reorder(s_in_mem, s_mem).execute(stream, s_in_mem, s_mem);
-  dnnl::reorder(w_in_mem, w_mem).execute(stream, w_in_mem, w_mem);
+struct Int8Options {
+  // u8 instead of s8 activations.
+  bool u8_src = false;
+  // Raw s32 accumulators instead of dequantized f32 output.
+  bool s32_dst = false;
+  // Weight scales; oneDNN inner product only takes a common src scale, so
+  // activations are always quantized per tensor.
+  QuantScales weight_scales = QuantScales::per_row;
+};
+
+struct Int8Result {
+  // Median on-the-fly quantization of the activations, paid on every call.
+  int64_t quantize_src_ns = 0;
+  // One-off quantization of the weights.
+  int64_t quantize_weights_ns = 0;
+  // Against an f64 reference on the f32 inputs, over sampled outputs.
+  double max_abs_err = 0;
+  double max_rel_err = 0;
+};
+
+// Dequantized int8 output against the f32 inputs, on up to 16 rows x 1024
+// columns spread over the output.
+static void int8_error(int32_t n, int32_t oc, int32_t ic, float const *src,
+                       float const *w, QuantizedMatrix const &s_q,
+                       QuantizedMatrix const &w_q, bool s32_dst,
+                       void const *dst, Int8Result &out) {
+  int32_t row_step = std::max(1, n / 16);
+  int32_t col_step = std::max(1, oc / 1024);
+  out.max_abs_err = 0;
+  out.max_rel_err = 0;
+  for (int64_t r = 0; r < n; r += row_step) {
+    for (int64_t c = 0; c < oc; c += col_step) {
+      double ref = 0;
+      for (int64_t p = 0; p < ic; p++) {
+        ref += (double)src[r * ic + p] * w[c * ic + p];
+      }
+      double got;
+      if (s32_dst) {
+        got = static_cast<int32_t const *>(dst)[r * oc + c] *
+              (double)quant_scale(s_q, r) * quant_scale(w_q, c);
+      } else {
+        got = static_cast<float const *>(dst)[r * oc + c];
+      }
+      double err = std::fabs(got - ref);
+      out.max_abs_err = std::max(out.max_abs_err, err);
+      if (ref != 0)
+        out.max_rel_err = std::max(out.max_rel_err, err / std::fabs(ref));
+    }
+  }
+}
+
+// s8/u8 x s8 inner product. Weights are quantized once; activations are
+// quantized on every call, which is timed separately and reported in
+// `out` next to the error of the dequantized result.
+static LatencyStats amx_inner_product_int8(int32_t const &n, int32_t const &oc,
+                                           int32_t const &ic, const float *src,
+                                           const float *w,
+                                           Int8Options const &int8,
+                                           dnnl::engine &engine,
+                                           dnnl::stream &stream,
+                                           PrimitiveCache &cache,
+                                           KernelOptions const &opts,
+                                           Int8Result &out) {
+  std::string dims =
+      std::to_string(n) + "," + std::to_string(oc) + "," + std::to_string(ic);
+  QuantizedMatrix w_q, s_q;
+  auto start = std::chrono::high_resolution_clock::now();
+  quantize_matrix(w, oc, ic, false, int8.weight_scales, w_q);
+  auto end = std::chrono::high_resolution_clock::now();
+  out.quantize_weights_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  auto q_st = time_function(opts, "quantize src: dims: " + dims, [&]() {
+    quantize_matrix(src, n, ic, int8.u8_src, QuantScales::per_tensor, s_q);
+  });
+  out.quantize_src_ns = q_st.median;
+
+  dnnl::memory::dims s_dims = {n, ic};
+  dnnl::memory::dims w_dims = {oc, ic};
+  dnnl::memory::dims dst_dims = {n, oc};
+  dt s_dt = int8.u8_src ? dt::u8 : dt::s8;
+  dt dst_dt = int8.s32_dst ? dt::s32 : dt::f32;
+  int w_mask = int8.weight_scales == QuantScales::per_row ? 1 : 0;
+
+  auto prop = dnnl::prop_kind::forward_inference;
+  std::string key = "ip_int8;" + std::to_string(static_cast<int>(prop)) + ";" +
+                    std::to_string(w_mask) + ";" +
+                    PrimitiveCache::key(s_dims, s_dt, tag::any) +
+                    PrimitiveCache::key(w_dims, dt::s8, tag::any) +
+                    PrimitiveCache::key(dst_dims, dst_dt, tag::ab);
+  auto &entry = cache.get(key, [&]() {
+    auto s_md = dnnl::memory::desc(s_dims, s_dt, tag::any);
+    auto w_md = dnnl::memory::desc(w_dims, dt::s8, tag::any);
+    auto dst_md = dnnl::memory::desc(dst_dims, dst_dt, tag::ab);
+    // With s32 output the accumulators are returned unscaled.
+    dnnl::primitive_attr attr;
+    if (!int8.s32_dst) {
+      attr.set_scales_mask(DNNL_ARG_SRC, 0);
+      attr.set_scales_mask(DNNL_ARG_WEIGHTS, w_mask);
+    }
+    auto pd = dnnl::inner_product_forward::primitive_desc(
+        engine, prop, s_md, w_md, dst_md, attr);
+    return PrimitiveCache::Entry{dnnl::inner_product_forward(pd),
+                                 pd.src_desc(), pd.weights_desc(),
+                                 pd.dst_desc()};
+  });
+
+  dnnl::memory s_in_mem(dnnl::memory::desc(s_dims, s_dt, tag::ab), engine,
+                        s_q.data.data());
+  dnnl::memory w_in_mem(dnnl::memory::desc(w_dims, dt::s8, tag::ab), engine,
+                        w_q.data.data());
+  auto s_mem = reorder_to(s_in_mem, entry.src_md, key + "reorder_src", engine,
+                          stream, cache, opts);
+  auto w_mem = reorder_to(w_in_mem, entry.weights_md, key + "reorder_weights",
+                          engine, stream, cache, opts);
+  auto dst_mem = new_memory(entry.dst_md, engine, opts);
 
-  auto prim = dnnl::inner_product_forward(pd);
   std::unordered_map<int32_t, dnnl::memory> args;
   args.insert({DNNL_ARG_SRC, s_mem});
   args.insert({DNNL_ARG_WEIGHTS, w_mem});
   args.insert({DNNL_ARG_DST, dst_mem});
+  if (!int8.s32_dst) {
+    dnnl::memory s_scales(
+        dnnl::memory::desc({(int64_t)s_q.scales.size()}, dt::f32, tag::a),
+        engine, s_q.scales.data());
+    dnnl::memory w_scales(
+        dnnl::memory::desc({(int64_t)w_q.scales.size()}, dt::f32, tag::a),
+        engine, w_q.scales.data());
+    args.insert({DNNL_ARG_ATTR_SCALES | DNNL_ARG_SRC, s_scales});
+    args.insert({DNNL_ARG_ATTR_SCALES | DNNL_ARG_WEIGHTS, w_scales});
+  }
+
+  auto st =
+      time_primitive(entry.prim, args, stream, opts, "ip int8: dims: " + dims);
+  int8_error(n, oc, ic, src, w, s_q, w_q, int8.s32_dst,
+             dst_mem.get_data_handle(), out);
+  return st;
+}
+
+// Inner product with the weight rows (output channels) split across NUMA
+// nodes. Each node packs its own shard into node-local memory and runs its
+// own engine, stream and OpenMP team on it; the per-node outputs are then
+// gathered into one n x oc matrix.
+class ShardedInnerProduct {
+public:
+  struct Shard {
+    int node = 0;
+    int32_t begin = 0;
+    int32_t rows = 0;
+    dnnl::engine engine;
+    dnnl::stream stream;
+    PrimitiveCache cache;
+    PackedWeights weights;
+    KernelOptions opts;
+  };
+
+  int32_t oc;
+  int32_t ic;
+  // Wall time of the slowest shard's weight packing.
+  int64_t pack_ns = 0;
+
+  // With `w_replicas`, each node packs its shard from its own copy of `w`.
+  // `threads` is split evenly across the nodes; each shard's primitives are
+  // created and cached under its node's share.
+  ShardedInnerProduct(int32_t const &n_hint, int32_t const &oc,
+                      int32_t const &ic, const float *w,
+                      KernelOptions const &opts,
+                      NodeReplicas<float> const *w_replicas = nullptr,
+                      int32_t threads = omp_get_max_threads())
+      : oc(oc), ic(ic), workers(numa_nodes(), threads),
+        shards(workers.size()) {
+    int32_t per_node = (oc + workers.size() - 1) / workers.size();
+    for (int node = 0; node < workers.size(); node++) {
+      auto &shard = shards[node];
+      shard.node = node;
+      shard.begin = std::min(oc, node * per_node);
+      shard.rows = std::min(oc - shard.begin, per_node);
+      shard.opts = opts;
+      if (workers.size() > 1) {
+        shard.opts.placement.policy = NumaPolicy::bind;
+        shard.opts.placement.node = node;
+      }
+    }
 
-  int64_t diff = 0;
-  for (int32_t i = 0; i < ITERATIONS; i++) {
     auto start = std::chrono::high_resolution_clock::now();
-    prim.execute(stream, args);
-    stream.wait();
+    workers.run([&](int node) {
+      auto &shard = shards[node];
+      if (shard.rows == 0)
+        return;
+      shard.engine = dnnl::engine(dnnl::engine::kind::cpu, 0);
+      shard.stream = dnnl::stream(shard.engine);
+      float const *node_w = w_replicas ? w_replicas->on(node) : w;
+      shard.weights = pack_ip_weights(
+          n_hint, shard.rows, ic, node_w + (size_t)shard.begin * ic,
+          shard.engine, shard.stream, shard.cache, shard.opts);
+    });
     auto end = std::chrono::high_resolution_clock::now();
-    diff = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    if (debug) {
-      std::cout << "ip: dims: " << n << "," << oc << "," << ic << ": itr #" << i << " :"  << diff << " ns" << std::endl;
+    pack_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+  }
+
+  int shard_count() const { return shards.size(); }
+
+  // Weight reorder time summed over the shards, repacks included.
+  int64_t reorder_ns() const {
+    int64_t ns = 0;
+    for (auto const &shard : shards)
+      ns += shard.weights.reorder_ns;
+    return ns;
+  }
+
+  // Times src (n x ic) against all shards; each sample covers the slowest
+  // shard plus gathering into `dst` (n x oc, skipped when null). With
+  // `src_replicas`, each node reads its own copy of `src`.
+  LatencyStats run(int32_t const &n, const float *src, float *dst,
+                   NodeReplicas<float> const *src_replicas = nullptr) {
+    std::vector<PreparedPrimitive> prepared(shards.size());
+    workers.run([&](int node) {
+      auto &shard = shards[node];
+      if (shard.rows == 0)
+        return;
+      float const *node_src = src_replicas ? src_replicas->on(node) : src;
+      prepared[node] =
+          prepare_inner_product(n, node_src, shard.weights, shard.engine,
+                                shard.stream, shard.cache, shard.opts);
+    });
+
+    return time_function(
+        shards[0].opts,
+        "sharded ip: dims: " + std::to_string(n) + "," + std::to_string(oc) +
+            "," + std::to_string(ic),
+        [&]() {
+          workers.run([&](int node) {
+            auto &shard = shards[node];
+            if (shard.rows == 0)
+              return;
+            prepared[node].prim.execute(shard.stream, prepared[node].args);
+            shard.stream.wait();
+            if (dst)
+              gather(shard, n,
+                     static_cast<float const *>(
+                         prepared[node].args[DNNL_ARG_DST].get_data_handle()),
+                     dst);
+          });
+        });
+  }
+
+private:
+  // Copies the shard's n x rows output into its columns of `dst`.
+  void gather(Shard const &shard, int32_t n, float const *out, float *dst) {
+#pragma omp parallel for
+    for (int32_t r = 0; r < n; r++) {
+      std::memcpy(dst + (size_t)r * oc + shard.begin,
+                  out + (size_t)r * shard.rows, shard.rows * sizeof(float));
+    }
+  }
+
+  NodeWorkers workers;
+  std::vector<Shard> shards;
+};
+
+// Best k (score, id) pairs per query, best first; `scores`/`ids` are n x k.
+struct TopKResult {
+  int32_t k = 0;
+  std::vector<float> scores;
+  std::vector<int64_t> ids;
+  // Time spent reordering weights before the timed runs.
+  int64_t reorder_ns = 0;
+};
+
+using TopKHeap = std::vector<std::pair<float, int64_t>>;
+
+// Feeds `len` scores with ids base.. into a min-heap holding the best k.
+// Once the heap is full, AVX-512 compares 16 scores at a time against the
+// current k-th best so only candidates that beat it touch the heap.
+static void topk_update(float const *scores, int64_t base, int32_t len,
+                        int32_t k, TopKHeap &heap) {
+  auto cmp = std::greater<std::pair<float, int64_t>>();
+  int32_t j = 0;
+  for (; j < len && (int32_t)heap.size() < k; j++) {
+    heap.emplace_back(scores[j], base + j);
+    std::push_heap(heap.begin(), heap.end(), cmp);
+  }
+  if (heap.empty())
+    return;
+  float thresh = heap.front().first;
+  auto offer = [&](int32_t idx) {
+    if (scores[idx] > thresh) {
+      std::pop_heap(heap.begin(), heap.end(), cmp);
+      heap.back() = {scores[idx], base + idx};
+      std::push_heap(heap.begin(), heap.end(), cmp);
+      thresh = heap.front().first;
+    }
+  };
+#if defined(__AVX512F__)
+  for (; j + 16 <= len; j += 16) {
+    __mmask16 m = _mm512_cmp_ps_mask(_mm512_loadu_ps(scores + j),
+                                     _mm512_set1_ps(thresh), _CMP_GT_OQ);
+    while (m) {
+      offer(j + __builtin_ctz(m));
+      m &= m - 1;
     }
   }
-  return diff;
+#endif
+  for (; j < len; j++) {
+    offer(j);
+  }
+}
+
+// Writes the best k of `heaps` (several partial heaps for one query) into
+// row `q` of `out`, best first.
+static void topk_finish(std::vector<TopKHeap const *> const &heaps, int32_t q,
+                        TopKResult &out) {
+  TopKHeap all;
+  for (auto *h : heaps)
+    all.insert(all.end(), h->begin(), h->end());
+  int32_t kk = std::min<int64_t>(out.k, all.size());
+  std::partial_sort(all.begin(), all.begin() + kk, all.end(),
+                    std::greater<std::pair<float, int64_t>>());
+  for (int32_t i = 0; i < kk; i++) {
+    out.scores[(size_t)q * out.k + i] = all[i].first;
+    out.ids[(size_t)q * out.k + i] = all[i].second;
+  }
+}
+
+// Rows of weights per tile, sized so a thread's n x block score tile fills
+// about half of L2. The cap is on the tile's bytes, not its rows: with
+// large n the block shrinks down to one 16-row AMX tile rather than
+// spilling the scores to memory.
+static int32_t topk_block_rows(int32_t n, int32_t oc) {
+  size_t l2 = cache_bytes(2);
+  if (l2 == 0)
+    l2 = size_t(2) << 20;
+  size_t tile_rows = l2 / 2 / (std::max(n, 1) * sizeof(float));
+  int32_t block = std::clamp<size_t>(tile_rows, 16, 16384);
+  block = block >= 64 ? block / 64 * 64 : block / 16 * 16;
+  return std::min(block, oc);
+}
+
+// Inner product fused with per-query top-k: the weights are packed in
+// blocks of rows and every thread runs the (single-threaded) IP primitive on
+// its own blocks, folding each n x block tile of scores into per-query heaps
+// right away. The n x oc score matrix is never materialized.
+static LatencyStats amx_inner_product_topk(int32_t const &n, int32_t const &oc,
+                                           int32_t const &ic, const float *src,
+                                           const float *w, int32_t k,
+                                           dnnl::engine &engine,
+                                           dnnl::stream &stream,
+                                           PrimitiveCache &cache,
+                                           KernelOptions const &opts,
+                                           TopKResult &out) {
+  int32_t block = topk_block_rows(n, oc);
+  int32_t blocks = (oc + block - 1) / block;
+  int32_t tail = oc - (blocks - 1) * block;
+
+  // Each block's primitive runs inside the parallel region below, where
+  // oneDNN runs it on the calling thread alone, so it is created (and
+  // cached) for one thread.
+  int32_t threads = omp_get_max_threads();
+  std::string key, tail_key;
+  omp_set_num_threads(1);
+  auto &entry = ip_primitive(n, block, ic, engine, cache, key);
+  auto &tail_entry = ip_primitive(n, tail, ic, engine, cache, tail_key);
+  omp_set_num_threads(threads);
+
+  auto s_in_md = dnnl::memory::desc({n, ic}, dt::f32, tag::ab);
+  auto s_in_mem = make_input_memory(s_in_md, src, engine, opts);
+  auto s_mem = reorder_to(s_in_mem, entry.src_md, key + "reorder_src", engine,
+                          stream, cache, opts);
+  auto s_tail_mem = entry.src_md == tail_entry.src_md
+                        ? s_mem
+                        : reorder_to(s_in_mem, tail_entry.src_md,
+                                     tail_key + "reorder_src", engine, stream,
+                                     cache, opts);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<OwnedMemory> w_blocks(blocks);
+  for (int32_t b = 0; b < blocks; b++) {
+    int32_t rows = b == blocks - 1 ? tail : block;
+    auto &e = b == blocks - 1 ? tail_entry : entry;
+    auto w_in_md = dnnl::memory::desc({rows, ic}, dt::f32, tag::ab);
+    auto w_in_mem =
+        make_input_memory(w_in_md, w + (size_t)b * block * ic, engine, opts);
+    w_blocks[b] = reorder_to(w_in_mem, e.weights_md,
+                             (b == blocks - 1 ? tail_key : key) +
+                                 "reorder_weights",
+                             engine, stream, cache, opts);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  out.reorder_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+  std::vector<std::vector<TopKHeap>> heaps(threads, std::vector<TopKHeap>(n));
+  std::vector<OwnedMemory> dst(threads), dst_tail(threads);
+  std::vector<dnnl::stream> streams(threads);
+  for (int32_t t = 0; t < threads; t++) {
+    dst[t] = new_memory(entry.dst_md, engine, opts);
+    dst_tail[t] = new_memory(tail_entry.dst_md, engine, opts);
+    streams[t] = dnnl::stream(engine);
+  }
+  out.k = k;
+  out.scores.assign((size_t)n * k, 0);
+  out.ids.assign((size_t)n * k, -1);
+
+  auto once = [&]() {
+#pragma omp parallel
+    {
+      int32_t t = omp_get_thread_num();
+      for (auto &h : heaps[t])
+        h.clear();
+#pragma omp for schedule(dynamic)
+      for (int32_t b = 0; b < blocks; b++) {
+        bool last = b == blocks - 1;
+        int32_t rows = last ? tail : block;
+        auto &d = last ? dst_tail[t] : dst[t];
+        (last ? tail_entry : entry)
+            .prim.execute(streams[t], {{DNNL_ARG_SRC, last ? s_tail_mem : s_mem},
+                                       {DNNL_ARG_WEIGHTS, w_blocks[b]},
+                                       {DNNL_ARG_DST, d}});
+        streams[t].wait();
+        auto *scores = static_cast<float const *>(d.get_data_handle());
+        for (int32_t q = 0; q < n; q++) {
+          topk_update(scores + (size_t)q * rows, (int64_t)b * block, rows, k,
+                      heaps[t][q]);
+        }
+      }
+#pragma omp for
+      for (int32_t q = 0; q < n; q++) {
+        std::vector<TopKHeap const *> parts;
+        for (auto &h : heaps)
+          parts.push_back(&h[q]);
+        topk_finish(parts, q, out);
+      }
+    }
+  };
+
+  return time_function(opts,
+                       "ip topk: dims: " + std::to_string(n) + "," +
+                           std::to_string(oc) + "," + std::to_string(ic),
+                       once);
+}
+
+// Reference for amx_inner_product_topk: the full n x oc IP followed by a
+// std::partial_sort of every query's scores.
+static LatencyStats amx_inner_product_partial_sort(
+    int32_t const &n, int32_t const &oc, int32_t const &ic, const float *src,
+    const float *w, int32_t k, dnnl::engine &engine, dnnl::stream &stream,
+    PrimitiveCache &cache, KernelOptions const &opts, TopKResult &out) {
+  auto packed =
+      pack_ip_weights(n, oc, ic, w, engine, stream, cache, opts);
+  auto prepared =
+      prepare_inner_product(n, src, packed, engine, stream, cache, opts);
+  out.reorder_ns = packed.reorder_ns;
+  out.k = k;
+  out.scores.assign((size_t)n * k, 0);
+  out.ids.assign((size_t)n * k, -1);
+  int32_t kk = std::min(k, oc);
+  auto *scores = static_cast<float const *>(
+      prepared.args[DNNL_ARG_DST].get_data_handle());
+
+  // Index buffers are allocated once, outside the timed region.
+  std::vector<std::vector<int64_t>> idx_buffers(omp_get_max_threads(),
+                                                std::vector<int64_t>(oc));
+
+  auto once = [&]() {
+    prepared.prim.execute(stream, prepared.args);
+    stream.wait();
+#pragma omp parallel
+    {
+      auto &idx = idx_buffers[omp_get_thread_num()];
+#pragma omp for
+      for (int32_t q = 0; q < n; q++) {
+        float const *row = scores + (size_t)q * oc;
+        for (int32_t j = 0; j < oc; j++)
+          idx[j] = j;
+        std::partial_sort(idx.begin(), idx.begin() + kk, idx.end(),
+                          [&](int64_t x, int64_t y) { return row[x] > row[y]; });
+        for (int32_t i = 0; i < kk; i++) {
+          out.scores[(size_t)q * k + i] = row[idx[i]];
+          out.ids[(size_t)q * k + i] = idx[i];
+        }
+      }
+    }
+  };
+
+  return time_function(opts,
+                       "ip + partial_sort: dims: " + std::to_string(n) + "," +
+                           std::to_string(oc) + "," + std::to_string(ic),
+                       once);
 }
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+// Page backing for benchmark buffers.
+enum class PageMode {
+  // Whatever malloc / the library does (THP per system setting).
+  system,
+  // 4 KiB pages, THP disabled for the mapping.
+  small,
+  // Transparent huge pages requested with madvise(MADV_HUGEPAGE).
+  thp,
+  // Explicit hugetlbfs pages; these need pages reserved in
+  // /proc/sys/vm/nr_hugepages (or the 1 GiB pool) beforehand.
+  huge_2m,
+  huge_1g,
+};
+
+static std::string page_mode_name(PageMode mode) {
+  switch (mode) {
+  case PageMode::system:
+    return "system";
+  case PageMode::small:
+    return "4K";
+  case PageMode::thp:
+    return "THP";
+  case PageMode::huge_2m:
+    return "2M";
+  case PageMode::huge_1g:
+    return "1G";
+  }
+  return "?";
+}
+
+static size_t page_mode_granularity(PageMode mode) {
+  switch (mode) {
+  case PageMode::huge_1g:
+    return size_t(1) << 30;
+  case PageMode::thp:
+  case PageMode::huge_2m:
+    return size_t(2) << 20;
+  default:
+    return 4096;
+  }
+}
+
+static size_t page_mode_round(size_t bytes, PageMode mode) {
+  size_t g = page_mode_granularity(mode);
+  return (bytes + g - 1) / g * g;
+}
+
+// Maps `bytes` (rounded up to the page size of `mode`). Not valid for
+// PageMode::system.
+static void *alloc_pages(size_t bytes, PageMode mode) {
+  size_t len = page_mode_round(bytes, mode);
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (mode == PageMode::huge_2m)
+    flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+  if (mode == PageMode::huge_1g)
+    flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+
+  if (mode == PageMode::thp) {
+    // Over-map so the buffer can start on a 2 MiB boundary.
+    size_t g = page_mode_granularity(mode);
+    void *raw = mmap(nullptr, len + g, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (raw == MAP_FAILED)
+      throw std::bad_alloc();
+    uintptr_t start = (reinterpret_cast<uintptr_t>(raw) + g - 1) & ~(g - 1);
+    size_t head = start - reinterpret_cast<uintptr_t>(raw);
+    if (head)
+      munmap(raw, head);
+    if (g - head)
+      munmap(reinterpret_cast<void *>(start + len), g - head);
+    madvise(reinterpret_cast<void *>(start), len, MADV_HUGEPAGE);
+    return reinterpret_cast<void *>(start);
+  }
+
+  void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (p == MAP_FAILED) {
+    if (flags & MAP_HUGETLB)
+      throw std::runtime_error("mmap with MAP_HUGETLB failed for " +
+                               page_mode_name(mode) +
+                               " pages; are enough huge pages reserved?");
+    throw std::bad_alloc();
+  }
+  if (mode == PageMode::small)
+    madvise(p, len, MADV_NOHUGEPAGE);
+  return p;
+}
+
+static void free_pages(void *p, size_t bytes, PageMode mode) {
+  if (p)
+    munmap(p, page_mode_round(bytes, mode));
+}
+
+// Shared ownership of a mapping from alloc_pages.
+inline std::shared_ptr<void> make_pages(size_t bytes, PageMode mode) {
+  return std::shared_ptr<void>(alloc_pages(bytes, mode), [bytes, mode](void *p) {
+    free_pages(p, bytes, mode);
+  });
+}
+
+template <typename T> struct AlignedAllocator {
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  static constexpr size_t alignment = 64;
+
+  PageMode pages = PageMode::system;
+
+  AlignedAllocator() = default;
+  explicit AlignedAllocator(PageMode pages) : pages(pages) {}
+  template <typename U>
+  AlignedAllocator(AlignedAllocator<U> const &other) : pages(other.pages) {}
+
+  T *allocate(size_t n) {
+    if (pages != PageMode::system)
+      return static_cast<T *>(alloc_pages(n * sizeof(T), pages));
+    size_t bytes = (n * sizeof(T) + alignment - 1) / alignment * alignment;
+    void *p = std::aligned_alloc(alignment, bytes);
+    if (!p)
+      throw std::bad_alloc();
+    return static_cast<T *>(p);
+  }
+  void deallocate(T *p, size_t n) {
+    if (pages != PageMode::system)
+      free_pages(p, n * sizeof(T), pages);
+    else
+      std::free(p);
+  }
+
+  // Default-initialize so sizing a vector does not touch its pages; the
+  // first write (e.g. a parallel fill) decides where they are placed.
+  template <typename U> void construct(U *p) { ::new ((void *)p) U; }
+  template <typename U, typename... Args> void construct(U *p, Args &&...args) {
+    ::new ((void *)p) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool operator==(AlignedAllocator<U> const &other) const {
+    return pages == other.pages;
+  }
+};
+
+using fvec = std::vector<float, AlignedAllocator<float>>;
@@ -1,164 +1,1035 @@
 #include "CLI11.hpp"
 #include "VariadicTable.hpp"
+#include "amx_gemm.hpp"
+#include "blas.hpp"
 #include "dist.hpp"
+#include "report.hpp"
+#include "rng.hpp"
+#include "roofline.hpp"
+#include "scaling.hpp"
+#include "simd_gemm.hpp"
+#include "sweep.hpp"
+#include "verify.hpp"
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
-#include <random>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <string>
 
 using pprinter =
-    VariadicTable<std::string, std::string, double, double, double, double>;
+    VariadicTable<std::string, std::string, int32_t, double, double, double,
+                  double, double, double, double, double, double, double,
+                  double, std::string, std::string, std::string, std::string,
+                  std::string>;
+using qprinter = VariadicTable<std::string, std::string, double, double,
+                               double, double, double>;
+using rprinter = VariadicTable<std::string, std::string, int32_t, double,
+                               double, double, double, std::string>;
+using sprinter = VariadicTable<std::string, std::string, int32_t, double,
+                               double, double, int32_t>;
 
 #define OMP_PARALLEL_FOR _Pragma("omp parallel for")
-#define L2_CACHE 96 * 1024 * 1024
-#define L3_CACHE 90 * 1024 * 1024
 
 double calc_data_size(uint64_t N1, uint64_t N2, uint64_t M) {
   return ((double)(N1 * M * sizeof(float)) + (double)(N2 * M * sizeof(float))) /
          ((double)(2 << 19));
 }
 
+// Benchmark-level switches; kernel-level ones live in KernelOptions.
+struct BenchmarkOptions {
+  // Engines run for every shape: "onednn", "native" (AmxBf16Gemm) and the
+  // FP32 baselines "avx512" and "avx2" (SimdF32Gemm) and "openblas".
+  std::set<std::string> engines = {"onednn"};
+  // Run the native engine on its AVX512-BF16 path even if AMX is present.
+  bool native_fallback = false;
+  // Run every shape with 4 KiB pages first, then with `KernelOptions::pages`.
+  bool compare_pages = false;
+  // Split IP weight rows across NUMA nodes (ShardedInnerProduct).
+  bool sharded = false;
+  // When > 0, IP rows compare fused top-k against IP + std::partial_sort.
+  int32_t topk = 0;
+  // oneDNN IP precision: "bf16", or "int8" for the quantized path with its
+  // own table. The other engines compute in bf16/f32 and only run with
+  // "bf16", so a sweep over both precisions measures them once per shape.
+  std::string dtype = "bf16";
+  Int8Options int8_opts;
+  // Check every row against a sampled f64 reference and stop at the first
+  // one whose max relative error exceeds the tolerance (0: by precision).
+  bool verify = false;
+  double verify_tol = 0;
+  // Print speedup / efficiency / knee per shape after a sweep over
+  // several thread counts.
+  bool scaling = false;
+  // Measured peaks; when set, every row also gets a roofline entry.
+  std::optional<Roofline> roofline;
+  // Receives every row as CSV / JSON lines when set.
+  ResultWriter *writer = nullptr;
+};
+
 class Benchmark {
 public:
   dnnl::engine engine;
   dnnl::stream stream;
-  bool debug;
+  PrimitiveCache cache;
+  std::optional<PackedWeights> packed;
+  std::unique_ptr<ShardedInnerProduct> sharded;
+  // Reference for the current shape when verifying.
+  std::optional<VerifySample> ref_sample;
+  KernelOptions opts;
+  BenchmarkOptions bench_opts;
 
   pprinter *pt;
   std::vector<std::string> headers = {
-      "Mode",       "N1 / N2 / M",   "Data size (MiB)",
-      "Total FLOP", "Duration (ns)", "GFLOPS"};
+      "Mode",       "N1 / N2 / M",   "Threads",  "Data size (MiB)",
+      "Total FLOP", "Duration (ns)", "GFLOPS",
+      "Min (ns)",   "P90 (ns)",      "P99 (ns)",
+      "Max (ns)",   "Stddev (ns)",   "Samples",
+      "Reorder (ns)", "Cache hit/miss", "NUMA",
+      "Pages",      "Max abs err",   "Max rel err"};
+  qprinter *qt;
+  bool has_quant_rows = false;
+  std::vector<std::string> quant_headers = {
+      "Mode",        "N1 / N2 / M", "TOPS",
+      "Quantize src (ns)", "Quantize weights (ns)",
+      "Max abs err", "Max rel err"};
+
+  rprinter *rt;
+  bool has_roofline_rows = false;
+  std::vector<std::string> roofline_headers = {
+      "Mode",           "N1 / N2 / M",       "Threads",
+      "FLOP/byte",      "Bandwidth (GB/s)",  "% peak compute",
+      "% peak memory",  "Bound"};
+  // Compulsory traffic of the current shape: f32 inputs read once and the
+  // f32 output written once.
+  double traffic_bytes = 0;
 
-  Benchmark(dnnl::engine engine, dnnl::stream stream, bool debug)
-      : engine(engine), stream(stream), debug(debug) {
+  // Median of every row so far, for the thread-scaling report.
+  struct RowRecord {
+    std::string mode;
+    std::string dims;
+    int32_t threads;
+    double median;
+  };
+  std::vector<RowRecord> records;
+  std::vector<std::string> scaling_headers = {
+      "Mode",    "N1 / N2 / M", "Threads", "Duration (ns)",
+      "Speedup", "Efficiency",  "Knee (threads)"};
+
+  Benchmark(dnnl::engine engine, dnnl::stream stream, KernelOptions opts,
+            BenchmarkOptions bench_opts = {})
+      : engine(engine), stream(stream), opts(opts), bench_opts(bench_opts) {
     pt = new pprinter(headers);
+    qt = new qprinter(quant_headers);
+    rt = new rprinter(roofline_headers);
   }
 
   void print_results() {
-    pt->print(std::cout);
+    bool tables = !bench_opts.writer || !bench_opts.writer->writes_stdout();
+    if (tables)
+      pt->print(std::cout);
     pt = new pprinter(headers);
+    if (has_quant_rows) {
+      if (tables)
+        qt->print(std::cout);
+      qt = new qprinter(quant_headers);
+      has_quant_rows = false;
+    }
+    if (has_roofline_rows) {
+      if (tables)
+        rt->print(std::cout);
+      rt = new rprinter(roofline_headers);
+      has_roofline_rows = false;
+    }
   }
 
-  void run_ip(uint64_t N1, uint64_t N2, uint64_t M) {
-    std::vector<float> mat_a(N1 * M);
-    std::vector<float> mat_b(N2 * M);
+  // Per-thread compute peak for the precision a row's engine computes in.
+  double peak_gflops_per_thread(std::string const &mode) const {
+    auto const &roof = *bench_opts.roofline;
+    if (mode.find("int8") != std::string::npos && roof.int8_gops > 0)
+      return roof.int8_gops;
+    bool f32 = mode.find("FP32") != std::string::npos ||
+               mode.find("sgemm") != std::string::npos;
+    // Without AMX the bf16 engines are held to the FP32 FMA roof.
+    if (f32 || roof.bf16_gflops == 0)
+      return roof.f32_gflops;
+    return roof.bf16_gflops;
+  }
 
-    std::mt19937_64 rng;
-    rng.seed(47);
-    std::uniform_real_distribution<float> distrib;
+  void add_roofline_row(std::string const &mode, std::string const &dims,
+                        int32_t threads, uint64_t total_flop, double ns) {
+    double peak = peak_gflops_per_thread(mode) * threads;
+    auto p = roofline_point(total_flop, traffic_bytes, ns, peak,
+                            roofline_read_gbs(*bench_opts.roofline, threads));
+    std::string bound = p.compute_bound ? "compute" : "memory";
+    rt->addRow(mode, dims, threads, p.intensity, p.bandwidth_gbs,
+               p.pct_compute, p.pct_memory, bound);
+    has_roofline_rows = true;
+    if (bench_opts.writer) {
+      bench_opts.writer->write("roofline", roofline_headers, mode, dims,
+                               threads, p.intensity, p.bandwidth_gbs,
+                               p.pct_compute, p.pct_memory, bound);
+    }
+  }
+
+  // Speedup and parallel efficiency per row mode and shape over the thread
+  // counts it was measured at, with the knee where scaling flattens.
+  void print_scaling() {
+    std::vector<std::pair<std::string, std::string>> order;
+    std::map<std::pair<std::string, std::string>, std::vector<ScalingRow>>
+        groups;
+    for (auto const &r : records) {
+      auto key = std::make_pair(r.mode, r.dims);
+      if (!groups.count(key))
+        order.push_back(key);
+      groups[key].push_back({r.threads, r.median});
+    }
 
-    OMP_PARALLEL_FOR
-    for (uint64_t i = 0; i < N1; i++) {
-      for (uint64_t j = 0; j < M; j++) {
-        mat_a[i * M + j] = distrib(rng);
+    sprinter table(scaling_headers);
+    bool any = false;
+    for (auto const &key : order) {
+      auto rows = scaling_rows(groups[key]);
+      if (rows.size() < 2)
+        continue;
+      any = true;
+      int32_t knee = scaling_knee(rows);
+      for (auto const &r : rows) {
+        table.addRow(key.first, key.second, r.threads, r.ns, r.speedup,
+                     r.efficiency, knee);
+        if (bench_opts.writer) {
+          bench_opts.writer->write("scaling", scaling_headers, key.first,
+                                   key.second, r.threads, r.ns, r.speedup,
+                                   r.efficiency, knee);
+        }
       }
     }
+    if (any && (!bench_opts.writer || !bench_opts.writer->writes_stdout()))
+      table.print(std::cout);
+  }
+
+  std::string cache_delta(uint64_t hits, uint64_t misses) {
+    return std::to_string(cache.hits - hits) + "/" +
+           std::to_string(cache.misses - misses);
+  }
+
+  static std::string format_error(double err) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3g", err);
+    return buf;
+  }
+
+  // Duration and GFLOPS are taken from the median sample. A row that failed
+  // verification is still printed, then the run stops.
+  void add_row(std::string const &mode, std::string const &dims,
+               double data_size, uint64_t total_flop, LatencyStats const &st,
+               double reorder, std::string const &cache_stats,
+               VerifyResult const &v = {}) {
+    double gflops = ((double)(total_flop)) / st.median;
+    int32_t threads = omp_get_max_threads();
+    records.push_back({mode, dims, threads, st.median});
+    if (bench_opts.roofline && traffic_bytes > 0)
+      add_roofline_row(mode, dims, threads, total_flop, st.median);
+    pt->addRow(mode, dims, threads, data_size, total_flop, st.median, gflops, st.min,
+               st.p90, st.p99, st.max, st.stddev, st.samples.size(), reorder,
+               cache_stats, placement_name(opts.placement),
+               page_mode_name(opts.pages),
+               v.checked ? format_error(v.max_abs) : "-",
+               v.checked ? format_error(v.max_rel) : "-");
+    if (bench_opts.writer) {
+      // Unverified rows get NaN errors (null in JSON).
+      bench_opts.writer->write(
+          "results", headers, mode, dims, threads, data_size, total_flop, st.median,
+          gflops, st.min, st.p90, st.p99, st.max, st.stddev,
+          (uint64_t)st.samples.size(), reorder, cache_stats,
+          placement_name(opts.placement), page_mode_name(opts.pages),
+          v.checked ? v.max_abs : NAN, v.checked ? v.max_rel : NAN);
+    }
+    if (!v.ok) {
+      print_results();
+      throw std::runtime_error(
+          mode + " " + dims + ": max relative error " +
+          format_error(v.max_rel) + " exceeds " + format_error(v.tolerance));
+    }
+  }
+
+  double tolerance(double by_precision) const {
+    return bench_opts.verify_tol > 0 ? bench_opts.verify_tol : by_precision;
+  }
+
+  // Samples the reference for the current shape when verifying.
+  void prepare_verify(uint64_t N1, uint64_t N2, uint64_t M, float const *a,
+                      float const *b, bool transposed) {
+    ref_sample.reset();
+    if (bench_opts.verify) {
+      ref_sample = reference_sample(N1, N2, M, a, b, transposed);
+    }
+  }
 
-    OMP_PARALLEL_FOR
-    for (uint64_t i = 0; i < N2; i++) {
-      for (uint64_t j = 0; j < M; j++) {
-        mat_b[i * M + j] = distrib(rng);
+  template <typename Get> VerifyResult verify(Get &&got, double by_precision) {
+    if (!ref_sample)
+      return {};
+    return check_sample(*ref_sample, got, tolerance(by_precision));
+  }
+
+  VerifyResult verify(fvec const &out, uint64_t N2, double by_precision) {
+    return verify([&](int64_t r, int64_t c) { return out[r * N2 + c]; },
+                  by_precision);
+  }
+
+  VerifyResult verify(dnnl::memory const &dst, uint64_t N2,
+                      double by_precision) {
+    return verify(
+        [&](int64_t r, int64_t c) { return read_dnnl_value(dst, r * N2 + c); },
+        by_precision);
+  }
+
+  // Top-k results of a few queries against their full reference rows. The
+  // ids must be distinct and each must score within the tolerance of the
+  // reference k-th best, so ties at the boundary may go either way; each
+  // returned score must also match the reference score of its id.
+  VerifyResult verify_topk(TopKResult const &res, uint64_t N2, uint64_t M,
+                           float const *a, float const *b) {
+    if (!ref_sample)
+      return {};
+    // Full rows cost N2 x M each, so only a handful of queries.
+    constexpr int64_t max_queries = 8;
+    double tol = tolerance(VERIFY_TOL_BF16);
+    VerifySample s;
+    // With k > N2 only the first N2 entries of a query are filled.
+    int64_t kk = std::min<int64_t>(res.k, N2);
+    bool set_ok = true;
+    for (int64_t i : spread(ref_sample->rows.size(), max_queries)) {
+      int64_t q = ref_sample->rows[i];
+      auto row = reference_row(N2, M, a, b, true, q);
+      std::vector<double> sorted = row;
+      std::nth_element(sorted.begin(), sorted.begin() + (kk - 1),
+                       sorted.end(), std::greater<double>());
+      double kth = sorted[kk - 1];
+      double threshold = kth - tol * std::max(std::fabs(kth), 1e-12);
+
+      std::vector<int64_t> ids(res.ids.begin() + q * res.k,
+                               res.ids.begin() + q * res.k + kk);
+      std::sort(ids.begin(), ids.end());
+      set_ok &= std::adjacent_find(ids.begin(), ids.end()) == ids.end();
+      for (int64_t id : ids) {
+        set_ok &= id >= 0 && id < (int64_t)N2 && row[id] >= threshold;
+      }
+      s.rows.push_back(q);
+      for (int64_t j = 0; j < kk; j++) {
+        int64_t id = res.ids[q * res.k + j];
+        s.ref.push_back(id >= 0 && id < (int64_t)N2 ? row[id] : NAN);
       }
     }
+    for (int64_t j = 0; j < kk; j++)
+      s.cols.push_back(j);
+    auto v = check_sample(
+        s, [&](int64_t q, int64_t j) { return res.scores[q * res.k + j]; },
+        tol);
+    v.ok &= set_ok;
+    return v;
+  }
 
-    double data_size = calc_data_size(N1, N2, M);
-    uint64_t total_flop = (N1 * N2) * (2 * M - 1);
-    std::string dims =
-        std::to_string(N1) + "/" + std::to_string(N2) + "/" + std::to_string(M);
-    {
-      int64_t dur = amx_inner_product(
-        N1, N2, M, mat_a.data(), mat_b.data(), engine, stream, debug);
-      double gflops =
-          ((double)(total_flop)) / ((double)(dur));
-      pt->addRow("IP / AMX", dims, data_size, total_flop, dur, gflops);
+  fvec new_matrix(uint64_t n) {
+    return fvec(n, AlignedAllocator<float>(opts.pages));
+  }
+
+  template <typename Fn> void for_each_page_mode(Fn &&fn) {
+    if (!bench_opts.compare_pages || opts.pages == PageMode::small) {
+      fn();
+      return;
     }
+    PageMode chosen = opts.pages;
+    for (PageMode mode : {PageMode::small, chosen}) {
+      // Packed weights live in pages of the mode they were packed under.
+      packed.reset();
+      sharded.reset();
+      opts.pages = mode;
+      fn();
+    }
+    opts.pages = chosen;
+  }
+
+  void init_matrix(fvec &m, uint64_t seed) {
+    place_memory(m.data(), m.size() * sizeof(float), opts.placement);
+    fill_uniform(m.data(), m.size(), seed);
+  }
+
+  // The matrix itself, or with the replicate policy its copy on the calling
+  // thread's node; `replicas` keeps every node's copy for the sharded path.
+  float const *host_input(fvec const &m,
+                          std::unique_ptr<NodeReplicas<float>> &replicas) {
+    if (opts.placement.policy != NumaPolicy::replicate || m.empty())
+      return m.data();
+    replicas = std::make_unique<NodeReplicas<float>>(m.data(), m.size());
+    return replicas->local();
+  }
+
+  // Whether anything besides the packed or sharded oneDNN IP, which keep
+  // their own copy across batch sizes, reads the host weights of a shape.
+  // The int8 and top-k paths quantize or score straight from them.
+  bool others_read_weights() const {
+    for (auto const &e : bench_opts.engines) {
+      if (e != "onednn")
+        return true;
+    }
+    return bench_opts.verify || bench_opts.dtype == "int8" ||
+           bench_opts.topk > 0;
+  }
+
+  void run_ip(uint64_t N1, uint64_t N2, uint64_t M) {
+    for_each_page_mode([&]() { run_ip_once(N1, N2, M); });
   }
 
   void run_gemm(uint64_t N1, uint64_t N2, uint64_t M) {
-    std::vector<float> mat_a(N1 * M);
-    std::vector<float> mat_b(M * N2);
+    for_each_page_mode([&]() { run_gemm_once(N1, N2, M); });
+  }
 
-    std::mt19937 rng;
-    rng.seed(47);
-    std::uniform_real_distribution<float> distrib;
+  void run_ip_once(uint64_t N1, uint64_t N2, uint64_t M) {
+    fvec mat_a = new_matrix(N1 * M);
+    // With packed or sharded weights, the weight matrix is only generated
+    // when the weight shape changes.
+    bool need_weights;
+    if (bench_opts.sharded) {
+      need_weights = !sharded || sharded->oc != (int32_t)N2 ||
+                     sharded->ic != (int32_t)M;
+    } else {
+      need_weights = !opts.packed_weights || !packed ||
+                     packed->oc != (int32_t)N2 || packed->ic != (int32_t)M;
+    }
+    // Verification and the other engines need them for every shape.
+    bool host_weights = need_weights || others_read_weights();
+    fvec mat_b = new_matrix(host_weights ? N2 * M : 0);
 
-    OMP_PARALLEL_FOR
-    for (uint64_t i = 0; i < N1; i++) {
-      for (uint64_t j = 0; j < M; j++) {
-        mat_a[i * M + j] = distrib(rng);
-      }
+    init_matrix(mat_a, 47);
+    if (host_weights) {
+      init_matrix(mat_b, 48);
     }
+    std::unique_ptr<NodeReplicas<float>> a_replicas, b_replicas;
+    float const *a = host_input(mat_a, a_replicas);
+    float const *b = host_input(mat_b, b_replicas);
 
-    OMP_PARALLEL_FOR
-    for (uint64_t i = 0; i < M; i++) {
-      for (uint64_t j = 0; j < N2; j++) {
-        mat_b[i * N2 + j] = distrib(rng);
+    double data_size = calc_data_size(N1, N2, M);
+    uint64_t total_flop = (N1 * N2) * (2 * M - 1);
+    std::string dims =
+        std::to_string(N1) + "/" + std::to_string(N2) + "/" + std::to_string(M);
+    prepare_verify(N1, N2, M, a, b, true);
+    traffic_bytes = (double)(N1 * M + N2 * M + N1 * N2) * sizeof(float);
+    bool int8 = bench_opts.dtype == "int8";
+    if (!int8) {
+      if (bench_opts.engines.count("native")) {
+        run_native(N1, N2, M, a, b, true, "IP", dims, data_size, total_flop);
       }
+      run_simd(N1, N2, M, a, b, true, "IP", dims, data_size, total_flop);
+      if (bench_opts.engines.count("openblas")) {
+        run_openblas(N1, N2, M, a, b, true, "IP", dims, data_size,
+                     total_flop);
+      }
+    }
+    if (!bench_opts.engines.count("onednn")) {
+      return;
+    }
+    if (int8) {
+      run_int8(N1, N2, M, a, b, dims, data_size, total_flop);
+    } else if (bench_opts.topk > 0) {
+      int32_t k = bench_opts.topk;
+      std::string suffix = " (k=" + std::to_string(k) + ")";
+      // Only the k best scores and ids per query are written.
+      traffic_bytes = (double)(N1 * M + N2 * M) * sizeof(float) +
+                      (double)N1 * k * (sizeof(float) + sizeof(int64_t));
+      TopKResult ref, fused;
+      uint64_t hits = cache.hits, misses = cache.misses;
+      auto st = amx_inner_product_partial_sort(N1, N2, M, a, b, k, engine,
+                                               stream, cache, opts, ref);
+      add_row("IP + partial_sort" + suffix, dims, data_size, total_flop, st,
+              ref.reorder_ns, cache_delta(hits, misses),
+              verify_topk(ref, N2, M, a, b));
+      hits = cache.hits, misses = cache.misses;
+      st = amx_inner_product_topk(N1, N2, M, a, b, k, engine, stream, cache,
+                                  opts, fused);
+      add_row("IP top-k fused" + suffix, dims, data_size, total_flop, st,
+              fused.reorder_ns, cache_delta(hits, misses),
+              verify_topk(fused, N2, M, a, b));
+      if (opts.debug) {
+        uint64_t differ = 0;
+        for (uint64_t q = 0; q < N1; q++) {
+          differ += ref.ids[q * k] != fused.ids[q * k];
+        }
+        std::cout << "top-k: " << differ << " of " << N1
+                  << " queries differ in their best match" << std::endl;
+      }
+    } else if (bench_opts.sharded) {
+      int64_t reorder = 0;
+      if (need_weights) {
+        sharded.reset();
+        sharded = std::make_unique<ShardedInnerProduct>(N1, N2, M, b, opts,
+                                                        b_replicas.get());
+        reorder = sharded->pack_ns;
+      }
+      fvec out = new_matrix(N1 * N2);
+      // A batch size whose primitive wants another layout repacks shards.
+      int64_t packed_ns = sharded->reorder_ns();
+      auto st = sharded->run(N1, a, out.data(), a_replicas.get());
+      reorder += sharded->reorder_ns() - packed_ns;
+      add_row("IP / AMX (sharded x" + std::to_string(sharded->shard_count()) +
+                  ")",
+              dims, data_size, total_flop, st, reorder, "-",
+              verify(out, N2, VERIFY_TOL_BF16));
+    } else if (opts.packed_weights) {
+      uint64_t hits = cache.hits, misses = cache.misses;
+      int64_t reorder = 0;
+      if (need_weights) {
+        packed = pack_ip_weights(N1, N2, M, b, engine, stream,
+                                 cache, opts);
+        reorder = packed->reorder_ns;
+      }
+      int64_t packed_ns = packed->reorder_ns;
+      OwnedMemory dst;
+      auto st = amx_inner_product(N1, a, *packed, engine, stream,
+                                  cache, opts, &dst);
+      reorder += packed->reorder_ns - packed_ns;
+      add_row("IP / AMX (packed)", dims, data_size, total_flop, st, reorder,
+              cache_delta(hits, misses), verify(dst, N2, VERIFY_TOL_BF16));
+    } else {
+      uint64_t hits = cache.hits, misses = cache.misses;
+      OwnedMemory dst;
+      auto st = amx_inner_product(
+        N1, N2, M, a, b, engine, stream, cache, opts, &dst);
+      add_row("IP / AMX", dims, data_size, total_flop, st, 0,
+              cache_delta(hits, misses), verify(dst, N2, VERIFY_TOL_BF16));
     }
+  }
+
+  void run_gemm_once(uint64_t N1, uint64_t N2, uint64_t M) {
+    if (bench_opts.dtype != "bf16") {
+      std::cerr << "GEMM has no " << bench_opts.dtype << " path, skipping"
+                << std::endl;
+      return;
+    }
+    fvec mat_a = new_matrix(N1 * M);
+    fvec mat_b = new_matrix(M * N2);
+
+    init_matrix(mat_a, 47);
+    init_matrix(mat_b, 48);
+    std::unique_ptr<NodeReplicas<float>> a_replicas, b_replicas;
+    float const *a = host_input(mat_a, a_replicas);
+    float const *b = host_input(mat_b, b_replicas);
 
     double data_size = calc_data_size(N1, N2, M);
     uint64_t total_flop = (N1 * N2) * (2 * M - 1);
     std::string dims =
         std::to_string(N1) + "/" + std::to_string(N2) + "/" + std::to_string(M);
+    prepare_verify(N1, N2, M, a, b, false);
+    traffic_bytes = (double)(N1 * M + M * N2 + N1 * N2) * sizeof(float);
+
+    if (bench_opts.engines.count("onednn")) {
+      uint64_t hits = cache.hits, misses = cache.misses;
+      OwnedMemory dst;
+      auto st = amx_matmul(
+        N1, N2, M, a, b, engine, stream, cache, opts, &dst);
+      add_row("GEMM / AMX", dims, data_size, total_flop, st, 0,
+              cache_delta(hits, misses), verify(dst, N2, VERIFY_TOL_BF16));
+    }
+    if (bench_opts.engines.count("native")) {
+      run_native(N1, N2, M, a, b, false, "GEMM", dims, data_size, total_flop);
+    }
+    run_simd(N1, N2, M, a, b, false, "GEMM", dims, data_size, total_flop);
+    if (bench_opts.engines.count("openblas")) {
+      run_openblas(N1, N2, M, a, b, false, "GEMM", dims, data_size,
+                   total_flop);
+    }
+  }
+
+  // Hand-written tile kernel; `b` holds IP weights (N2 x M) if `transposed`.
+  void run_native(uint64_t N1, uint64_t N2, uint64_t M, float const *a,
+                  float const *b, bool transposed, std::string const &op,
+                  std::string const &dims, double data_size,
+                  uint64_t total_flop) {
+    AmxBf16Gemm gemm(N1, N2, M, !bench_opts.native_fallback);
+    auto start = std::chrono::high_resolution_clock::now();
+    gemm.pack_a(a);
+    gemm.pack_b(b, transposed);
+    auto end = std::chrono::high_resolution_clock::now();
+    int64_t pack_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+    fvec out = new_matrix(N1 * N2);
+    auto st = time_function(opts, op + " native: dims: " + dims,
+                            [&]() { gemm.run(out.data()); });
+    add_row(op + " / native " + gemm.engine_name(), dims, data_size,
+            total_flop, st, pack_ns, "-", verify(out, N2, VERIFY_TOL_BF16));
+  }
+
+  // FP32 register-blocked baselines. When both ISAs run, their outputs are
+  // checked against each other.
+  void run_simd(uint64_t N1, uint64_t N2, uint64_t M, float const *a,
+                float const *b, bool transposed, std::string const &op,
+                std::string const &dims, double data_size,
+                uint64_t total_flop) {
+    std::vector<fvec> outs;
+    for (auto [name, isa] : {std::pair{"avx512", SimdIsa::avx512},
+                             std::pair{"avx2", SimdIsa::avx2}}) {
+      if (!bench_opts.engines.count(name))
+        continue;
+      if (!simd_isa_supported(isa)) {
+        std::cerr << simd_isa_name(isa) << " not supported, skipping"
+                  << std::endl;
+        continue;
+      }
+      SimdF32Gemm gemm(N1, N2, M, isa);
+      auto start = std::chrono::high_resolution_clock::now();
+      gemm.pack_a(a);
+      gemm.pack_b(b, transposed);
+      auto end = std::chrono::high_resolution_clock::now();
+      int64_t pack_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+              .count();
+      fvec out = new_matrix(N1 * N2);
+      auto st = time_function(opts, op + " " + name + ": dims: " + dims,
+                              [&]() { gemm.run(out.data()); });
+      add_row(op + " / " + simd_isa_name(isa) + " FP32", dims, data_size,
+              total_flop, st, pack_ns, "-", verify(out, N2, VERIFY_TOL_F32));
+      outs.push_back(std::move(out));
+    }
+
+    if (outs.size() == 2) {
+      double max_rel = 0;
+      for (uint64_t i = 0; i < N1 * N2; i++) {
+        double diff = std::fabs(outs[0][i] - outs[1][i]);
+        double ref = std::max(1e-30f, std::fabs(outs[0][i]));
+        max_rel = std::max(max_rel, diff / ref);
+      }
+      if (max_rel > 1e-4) {
+        std::cerr << op << " " << dims << ": AVX-512 and AVX2 results differ"
+                  << " (max rel " << max_rel << ")" << std::endl;
+      } else if (opts.debug) {
+        std::cout << op << " " << dims << ": AVX-512 vs AVX2 max rel "
+                  << max_rel << std::endl;
+      }
+    }
+  }
+
+  // `batch` independent size^3 GEMMs, or with size 0 a mix of 16..128
+  // shapes (native engine only, oneDNN needs uniform batches).
+  void run_batched(uint64_t batch, uint64_t size) {
+    std::vector<uint64_t> ms(batch), ns(batch), ks(batch);
+    uint64_t key = rng_key(49);
+    for (uint64_t i = 0; i < batch; i++) {
+      auto pick = [&](uint64_t j) {
+        return size ? size : 16 << (int)(rng_uniform(key, 3 * i + j) * 4);
+      };
+      ms[i] = pick(0), ns[i] = pick(1), ks[i] = pick(2);
+    }
+    uint64_t a_elems = 0, b_elems = 0, c_elems = 0, total_flop = 0;
+    for (uint64_t i = 0; i < batch; i++) {
+      a_elems += ms[i] * ks[i];
+      b_elems += ks[i] * ns[i];
+      c_elems += ms[i] * ns[i];
+      total_flop += ms[i] * ns[i] * (2 * ks[i] - 1);
+    }
+    fvec mat_a = new_matrix(a_elems);
+    fvec mat_b = new_matrix(b_elems);
+    fvec mat_c = new_matrix(c_elems);
+    init_matrix(mat_a, 47);
+    init_matrix(mat_b, 48);
+
+    double data_size = (double)((a_elems + b_elems) * sizeof(float)) /
+                       ((double)(2 << 19));
+    traffic_bytes = (double)(a_elems + b_elems + c_elems) * sizeof(float);
+    std::string shape = size ? std::to_string(size) + "^3" : "mixed";
+    std::string dims = std::to_string(batch) + " x " + shape;
+
+    std::vector<GemmProblem> problems(batch);
+    uint64_t a_off = 0, b_off = 0, c_off = 0;
+    for (uint64_t i = 0; i < batch; i++) {
+      problems[i] = {(int64_t)ms[i], (int64_t)ns[i], (int64_t)ks[i],
+                     mat_a.data() + a_off, mat_b.data() + b_off,
+                     mat_c.data() + c_off};
+      a_off += ms[i] * ks[i];
+      b_off += ks[i] * ns[i];
+      c_off += ms[i] * ns[i];
+    }
+
+    if (bench_opts.engines.count("onednn") && size) {
+      uint64_t hits = cache.hits, misses = cache.misses;
+      OwnedMemory dst;
+      auto st =
+          amx_matmul_batched(batch, size, size, size, mat_a.data(),
+                             mat_b.data(), engine, stream, cache, opts, &dst);
+      auto v = verify_batch(problems, [&](int64_t i, int64_t r, int64_t c) {
+        return read_dnnl_value(dst, (i * size + r) * size + c);
+      });
+      add_row("batched GEMM / AMX", dims, data_size, total_flop, st, 0,
+              cache_delta(hits, misses), v);
+    }
+    if (bench_opts.engines.count("native")) {
+      AmxBf16BatchedGemm gemm(!bench_opts.native_fallback);
+      auto st = time_function(opts, "batched native: dims: " + dims,
+                              [&]() { gemm.run(problems); });
+      auto v = verify_batch(problems, [&](int64_t i, int64_t r, int64_t c) {
+        return problems[i].c[r * problems[i].n + c];
+      });
+      add_row("batched GEMM / native " + gemm.engine_name(), dims, data_size,
+              total_flop, st, 0, "-", v);
+    }
+  }
+
+  // Checks up to 4 problems spread over the batch in full; `got(i, r, c)`
+  // reads element (r, c) of problem i's output.
+  template <typename Get>
+  VerifyResult verify_batch(std::vector<GemmProblem> const &problems,
+                            Get &&got) {
+    VerifyResult v;
+    if (!bench_opts.verify)
+      return v;
+    for (int64_t i : spread(problems.size(), 4)) {
+      auto const &p = problems[i];
+      auto sample = reference_sample(p.m, p.n, p.k, p.a, p.b, false, p.m, p.n);
+      auto pv = check_sample(
+          sample, [&](int64_t r, int64_t c) { return got(i, r, c); },
+          tolerance(VERIFY_TOL_BF16));
+      v.checked = true;
+      v.ok = v.ok && pv.ok;
+      v.tolerance = pv.tolerance;
+      v.max_abs = std::max(v.max_abs, pv.max_abs);
+      v.max_rel = std::max(v.max_rel, pv.max_rel);
+    }
+    return v;
+  }
+
+  // Quantized IP; the quantization cost and error go in their own table.
+  void run_int8(uint64_t N1, uint64_t N2, uint64_t M, float const *a,
+                float const *b, std::string const &dims, double data_size,
+                uint64_t total_flop) {
+    auto const &int8 = bench_opts.int8_opts;
+    std::string mode = std::string("IP / AMX int8 (") +
+                       (int8.u8_src ? "u8" : "s8") + "s8->" +
+                       (int8.s32_dst ? "s32" : "f32") + ")";
+    uint64_t hits = cache.hits, misses = cache.misses;
+    Int8Result res;
+    auto st = amx_inner_product_int8(N1, N2, M, a, b, int8, engine, stream,
+                                     cache, opts, res);
+    // The kernel already measured its error on sampled outputs.
+    VerifyResult v;
+    if (bench_opts.verify) {
+      v.checked = true;
+      v.max_abs = res.max_abs_err;
+      v.max_rel = res.max_rel_err;
+      v.tolerance = tolerance(VERIFY_TOL_INT8);
+      v.ok = v.max_rel <= v.tolerance;
+    }
+    add_row(mode, dims, data_size, total_flop, st, res.quantize_weights_ns,
+            cache_delta(hits, misses), v);
+    double tops = (double)total_flop / st.median / 1000;
+    qt->addRow(mode, dims, tops, res.quantize_src_ns, res.quantize_weights_ns,
+               res.max_abs_err, res.max_rel_err);
+    if (bench_opts.writer) {
+      bench_opts.writer->write("quantization", quant_headers, mode, dims, tops,
+                               res.quantize_src_ns, res.quantize_weights_ns,
+                               res.max_abs_err, res.max_rel_err);
+    }
+    has_quant_rows = true;
+  }
 
-    {
-      int64_t dur = amx_matmul(
-        N1, N2, M, mat_a.data(), mat_b.data(), engine, stream, debug);
-      double gflops =
-          ((double)(total_flop)) / ((double)(dur));
-      pt->addRow("GEMM / AMX", dims, data_size, total_flop, dur, gflops);
+  // cblas_sgemm on the same inputs, plus cblas_sbgemm when the library
+  // exports it; the bf16 conversion is reported as its reorder time.
+  void run_openblas(uint64_t N1, uint64_t N2, uint64_t M, float const *a,
+                    float const *b, bool transposed, std::string const &op,
+                    std::string const &dims, double data_size,
+                    uint64_t total_flop) {
+    blas_set_threads();
+    fvec out = new_matrix(N1 * N2);
+    auto st = time_function(opts, op + " sgemm: dims: " + dims, [&]() {
+      blas_sgemm(N1, N2, M, a, b, transposed, out.data());
+    });
+    add_row(op + " / OpenBLAS sgemm", dims, data_size, total_flop, st, 0, "-",
+            verify(out, N2, VERIFY_TOL_F32));
+
+    if (!blas_sbgemm_available()) {
+      if (opts.debug) {
+        std::cout << "cblas_sbgemm not available in " << blas_config()
+                  << std::endl;
+      }
+      return;
     }
+    std::vector<uint16_t, AlignedAllocator<uint16_t>> a16(
+        N1 * M, AlignedAllocator<uint16_t>(opts.pages));
+    std::vector<uint16_t, AlignedAllocator<uint16_t>> b16(
+        N2 * M, AlignedAllocator<uint16_t>(opts.pages));
+    auto start = std::chrono::high_resolution_clock::now();
+    convert_f32_to_bf16(a, a16.data(), a16.size());
+    convert_f32_to_bf16(b, b16.data(), b16.size());
+    auto end = std::chrono::high_resolution_clock::now();
+    int64_t convert_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+    st = time_function(opts, op + " sbgemm: dims: " + dims, [&]() {
+      blas_sbgemm(N1, N2, M, a16.data(), b16.data(), transposed, out.data());
+    });
+    add_row(op + " / OpenBLAS sbgemm", dims, data_size, total_flop, st,
+            convert_ns, "-", verify(out, N2, VERIFY_TOL_BF16));
   }
 };
 
-void run_bench_sq_matrix(bool debug) {
+// Batch size x shape for many independent small GEMMs.
+void run_bench_batched(KernelOptions const &opts,
+                       BenchmarkOptions const &bench_opts) {
   dnnl::engine engine(dnnl::engine::kind::cpu, 0);
   dnnl::stream stream(engine);
 
-  Benchmark bench(engine, stream, debug);
+  Benchmark bench(engine, stream, opts, bench_opts);
 
-  std::vector<uint64_t> sizes = {64,   128,  256,  512};
+  std::vector<uint64_t> batches = {1, 16, 256, 4096};
+  // 0 mixes shapes within the batch.
+  std::vector<uint64_t> sizes = {16, 32, 64, 128, 0};
   std::for_each(sizes.begin(), sizes.end(), [&](uint64_t size) {
-    bench.run_ip(size, size, size);
-  });
-  bench.print_results();
-  std::for_each(sizes.begin(), sizes.end(), [&](uint64_t size) {
-    bench.run_gemm(size, size, size);
+    std::for_each(batches.begin(), batches.end(), [&](uint64_t batch) {
+      bench.run_batched(batch, size);
+    });
   });
   bench.print_results();
 }
 
-void run_bench_rect_matrix(bool debug) {
+// Runs the points of `spec` that `control` wants, one table per mode.
+void run_sweep(KernelOptions const &opts, BenchmarkOptions const &bench_opts,
+               SweepSpec const &spec, SweepControl &control) {
+  for (auto const &mode : spec.modes) {
+    if (mode != "ip" && mode != "gemm")
+      throw std::invalid_argument("unknown mode " + mode + " (ip, gemm)");
+  }
+  for (auto const &dtype : spec.dtypes) {
+    if (dtype != "bf16" && dtype != "int8")
+      throw std::invalid_argument("unknown dtype " + dtype + " (bf16, int8)");
+  }
+
   dnnl::engine engine(dnnl::engine::kind::cpu, 0);
   dnnl::stream stream(engine);
 
-  Benchmark bench(engine, stream, debug);
+  Benchmark bench(engine, stream, opts, bench_opts);
 
-  std::vector<uint64_t> n1s = {1000, 10000, 100000};
-  std::vector<uint64_t> n2s = {1000000, 10000000};
-  std::vector<uint64_t> ms = {128, 200, 1536, 3072};
+  int32_t default_threads = omp_get_max_threads();
+  std::string last_mode;
+  for (auto const &point : spec.expand()) {
+    if (!control.wanted(point))
+      continue;
+    if (!last_mode.empty() && point.mode != last_mode)
+      bench.print_results();
+    last_mode = point.mode;
 
-  std::for_each(n1s.begin(), n1s.end(), [&](uint64_t n1) {
-    std::for_each(n2s.begin(), n2s.end(),
-      [&](uint64_t n2) {
-        std::for_each(ms.begin(), ms.end(),
-          [&](uint64_t m) {
-            bench.run_ip(n1, n2, m);
-          });
-      });
-  });
+    int32_t threads = point.threads ? point.threads : default_threads;
+    if (threads != omp_get_max_threads()) {
+      // Packed and sharded weights were laid out for the old thread count.
+      bench.packed.reset();
+      bench.sharded.reset();
+    }
+    omp_set_num_threads(threads);
+    bench.bench_opts.dtype = point.dtype;
+    if (point.mode == "ip")
+      bench.run_ip(point.n1, point.n2, point.m);
+    else
+      bench.run_gemm(point.n1, point.n2, point.m);
+    control.done(point);
+  }
+  omp_set_num_threads(default_threads);
   bench.print_results();
+  if (bench_opts.scaling)
+    bench.print_scaling();
 }
 
 int main(int argc, char **argv) {
   CLI::App app{"Intel AMX Benchmark"};
   argv = app.ensure_utf8(argv);
 
-  bool debug = 0;
-  app.add_option("-d,--debug", debug, "Enable debug mode");
+  KernelOptions opts;
+  app.add_option("-d,--debug", opts.debug, "Enable debug mode");
+  app.add_flag("--zero-copy", opts.zero_copy,
+               "Wrap host buffers in dnnl::memory instead of copying them");
+  app.add_flag("--packed-weights", opts.packed_weights,
+               "Reuse reordered IP weights across batch sizes");
+  app.add_option("-w,--warmup", opts.warmup,
+                 "Untimed executions before measuring");
+  app.add_option("-i,--iterations", opts.sampling.iterations,
+                 "Timed executions per measurement (minimum with --ci, unless --budget "
+                 "runs out first)");
+  app.add_option("--ci", opts.sampling.target_rel_ci,
+                 "Sample until the relative 95% CI is below this (e.g. 0.02)");
+  app.add_option("--budget", opts.sampling.budget_s,
+                 "Time budget in seconds per measurement with --ci");
+  std::map<std::string, NumaPolicy> numa_policies = {
+      {"first-touch", NumaPolicy::first_touch},
+      {"interleave", NumaPolicy::interleave},
+      {"bind", NumaPolicy::bind},
+      {"replicate", NumaPolicy::replicate}};
+  app.add_option("--numa", opts.placement.policy, "NUMA buffer placement")
+      ->transform(CLI::CheckedTransformer(numa_policies, CLI::ignore_case));
+  app.add_option("--numa-node", opts.placement.node, "Node for --numa bind");
+  std::map<std::string, ThreadPinning> pinnings = {
+      {"none", ThreadPinning::none},
+      {"compact", ThreadPinning::compact},
+      {"scatter", ThreadPinning::scatter}};
+  app.add_option("--pin", opts.placement.pinning,
+                 "Pin OpenMP threads: compact fills a node first, scatter "
+                 "alternates nodes")
+      ->transform(CLI::CheckedTransformer(pinnings, CLI::ignore_case));
+  std::map<std::string, PageMode> page_modes = {
+      {"system", PageMode::system}, {"4k", PageMode::small},
+      {"thp", PageMode::thp},       {"2m", PageMode::huge_2m},
+      {"1g", PageMode::huge_1g}};
+  app.add_option("--pages", opts.pages,
+                 "Page backing for host matrices and oneDNN buffers")
+      ->transform(CLI::CheckedTransformer(page_modes, CLI::ignore_case));
+  BenchmarkOptions bench_opts;
+  app.add_flag("--compare-pages", bench_opts.compare_pages,
+               "Run each shape with 4K pages and then with --pages");
+  app.add_flag("--sharded", bench_opts.sharded,
+               "Split IP weight rows across NUMA nodes, one thread team each");
+  app.add_option("--engines", bench_opts.engines,
+                 "Engines to run: onednn, native, avx512, avx2, openblas "
+                 "or all")
+      ->delimiter(',')
+      ->check(CLI::IsMember(
+          {"onednn", "native", "avx512", "avx2", "openblas", "all"}));
+  app.add_flag("--native-fallback", bench_opts.native_fallback,
+               "Run the native engine without AMX tiles (AVX512-BF16)");
+  app.add_option("--topk", bench_opts.topk,
+                 "Compare fused IP top-k against IP + partial_sort for this k");
+
+  bool int8 = false;
+  app.add_flag("--int8", int8,
+               "Also sweep the int8 IP path (same as adding int8 to --dtype)");
+  app.add_flag("--int8-u8", bench_opts.int8_opts.u8_src,
+               "Quantize activations to u8 instead of s8");
+  app.add_flag("--int8-s32", bench_opts.int8_opts.s32_dst,
+               "Return raw s32 accumulators instead of f32");
+  std::map<std::string, QuantScales> quant_scales = {
+      {"tensor", QuantScales::per_tensor}, {"row", QuantScales::per_row}};
+  app.add_option("--int8-scales", bench_opts.int8_opts.weight_scales,
+                 "Weight scale granularity: row or tensor")
+      ->transform(CLI::CheckedTransformer(quant_scales, CLI::ignore_case));
+
+  app.add_flag("--verify", bench_opts.verify,
+               "Check every row against a sampled f64 reference");
+  app.add_option("--verify-tol", bench_opts.verify_tol,
+                 "Max relative error for --verify (default by precision: "
+                 "f32 1e-4, bf16 2e-2, int8 5e-2)");
+  std::string csv_path, json_path;
+  app.add_option("--csv", csv_path,
+                 "Append results as CSV to this file (- for stdout)");
+  app.add_option("--json", json_path,
+                 "Append results as JSON lines to this file (- for stdout)");
+  bool roofline = false;
+  app.add_flag("--roofline", roofline,
+               "Calibrate peak compute and bandwidth, then add a roofline "
+               "table (intensity, % of peaks, bound)");
+  bool batched = false;
+  app.add_flag("--batched", batched,
+               "Run the batched small-GEMM sweep instead of the IP sweep");
+
+  // Sweep keys given on the command line override the sweep file, which
+  // overrides the preset.
+  std::string preset = "rect", sweep_file, filter, resume_path;
+  std::map<std::string, std::string> sweep_keys;
+  bool list_points = false;
+  app.add_option("--preset", preset,
+                 "Base sweep: rect (IP, N1 x N2 x M) or square (IP and GEMM)")
+      ->check(CLI::IsMember({"rect", "square"}));
+  app.add_option("--sweep-file", sweep_file,
+                 "Sweep keys (mode, dtype, threads, n1, n2, m, size) as "
+                 "key = value lines");
+  for (auto [key, help] :
+       {std::pair{"mode", "Modes: ip, gemm"},
+        std::pair{"dtype", "oneDNN IP precisions: bf16, int8"},
+        std::pair{"threads", "Thread counts, e.g. 1:48:x2 (0 = default)"},
+        std::pair{"n1", "Batch sizes, e.g. 1000:100000:x10"},
+        std::pair{"n2", "Output sizes (weight rows)"},
+        std::pair{"m", "Inner dimensions"},
+        std::pair{"size", "Square sizes (replaces n1/n2/m)"}}) {
+    app.add_option_function<std::string>(
+        std::string("--") + key,
+        [&sweep_keys, key](std::string const &v) { sweep_keys[key] = v; },
+        help);
+  }
+  app.add_option("--filter", filter,
+                 "Only run points whose id (mode/dtype/tT/N1xN2xM) matches "
+                 "this regex");
+  app.add_option("--resume", resume_path,
+                 "Log of completed points; points already in it are skipped");
+  app.add_flag("--list", list_points, "Print the sweep points and exit");
+  app.add_flag("--scaling", bench_opts.scaling,
+               "Rerun each shape at 1, 2, 4, ... threads (or --threads) and "
+               "report speedup, efficiency and knee point");
 
   CLI11_PARSE(app, argc, argv);
+  if (bench_opts.engines.count("all"))
+    bench_opts.engines = {"onednn", "native", "avx512", "avx2", "openblas"};
+
+  ResultWriter writer(collect_metadata("perf_amx", argc, argv));
+  if (!csv_path.empty() || !json_path.empty()) {
+    if (!csv_path.empty())
+      writer.open_csv(csv_path);
+    if (!json_path.empty())
+      writer.open_json(json_path);
+    bench_opts.writer = &writer;
+  }
+
+  auto cpus = pin_threads(opts.placement.pinning);
+  if (opts.debug) {
+    for (size_t t = 0; t < cpus.size(); t++) {
+      std::cout << "thread " << t << " -> cpu " << cpus[t] << std::endl;
+    }
+  }
+
+  try {
+    if (roofline) {
+      auto roof = calibrate_roofline();
+      int32_t threads = omp_get_max_threads();
+      if (!writer.writes_stdout()) {
+        std::cout << "peaks (" << threads << " threads): FP32 "
+                  << roof.f32_gflops * threads << " GFLOPS, BF16 "
+                  << roof.bf16_gflops * threads << " GFLOPS, INT8 "
+                  << roof.int8_gops * threads << " GOPS, read "
+                  << roof.mem_gbs << " GB/s" << std::endl;
+      }
+      writer.write("calibration",
+                   {"Threads", "FP32 GFLOPS/thread", "BF16 GFLOPS/thread",
+                    "INT8 GOPS/thread", "Read GB/s"},
+                   threads, roof.f32_gflops, roof.bf16_gflops, roof.int8_gops,
+                   roof.mem_gbs);
+      bench_opts.roofline = roof;
+    }
+    if (batched) {
+      run_bench_batched(opts, bench_opts);
+      return 0;
+    }
+
+    SweepSpec spec;
+    if (preset == "square") {
+      spec.modes = {"ip", "gemm"};
+      spec.sizes = {64, 128, 256, 512};
+    }
+    if (!sweep_file.empty())
+      spec.load(sweep_file);
+    if (bench_opts.scaling)
+      spec.threads = scaling_thread_counts(omp_get_max_threads());
+    for (auto const &[key, value] : sweep_keys)
+      spec.set(key, value);
+    if (int8 && std::find(spec.dtypes.begin(), spec.dtypes.end(), "int8") ==
+                    spec.dtypes.end())
+      spec.dtypes.push_back("int8");
 
-  // run_bench_sq_matrix(debug);
-  run_bench_rect_matrix(debug);
+    SweepControl control(filter, resume_path);
+    if (list_points) {
+      for (auto const &point : spec.expand()) {
+        if (control.wanted(point))
+          std::cout << point.id() << std::endl;
+      }
+      return 0;
+    }
+    run_sweep(opts, bench_opts, spec, control);
+  } catch (std::exception const &e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return 1;
+  }
 }
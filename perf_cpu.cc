@@ -1,9 +1,10 @@
+#include "CLI11.hpp"
+#include "report.hpp"
+#include "stats.hpp"
 #include <chrono>
 #include <iostream>
 
-double measure_mips() {
-  int64_t iterations = 1024 * 1024 * 1024;
-
+double measure_mips(int64_t iterations, SamplingPolicy const &policy) {
   int32_t a = 46776;
   int32_t b = 34445;
   int32_t c = 63344;
@@ -11,22 +12,23 @@ double measure_mips() {
   int32_t e = 19494;
   int32_t x = 0;
 
-  auto t1 = std::chrono::high_resolution_clock::now();
-  for (int64_t i = 0; i < iterations; i++) {
-    x = a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a + b + c +
-        d + e + a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a +
-        b + c + d + e + a + b + c + d + e + a + b + c + d + e;
-  }
-  auto t2 = std::chrono::high_resolution_clock::now();
-  auto diff =
-      std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+  auto samples = collect_samples(policy, [&]() {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int64_t i = 0; i < iterations; i++) {
+      x = a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a + b + c +
+          d + e + a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a +
+          b + c + d + e + a + b + c + d + e + a + b + c + d + e;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1)
+        .count();
+  });
+  auto diff = summarize(std::move(samples)).median;
   auto ips = ((double)(iterations * 49)) / ((double)(diff / 1e9));
   return (ips / 1e6);
 }
 
-double measure_flops() {
-  int64_t iterations = 1024 * 1024 * 1024;
-
+double measure_flops(int64_t iterations, SamplingPolicy const &policy) {
   float a = 46776.56857784;
   float b = 34445.14848484;
   float c = 63344.76857294;
@@ -34,23 +36,60 @@ double measure_flops() {
   float e = 19494.34848399;
   float x = 0.0;
 
-  auto t1 = std::chrono::high_resolution_clock::now();
-  for (int64_t i = 0; i < iterations; i++) {
-    x = a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a + b + c +
-        d + e + a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a +
-        b + c + d + e + a + b + c + d + e + a + b + c + d + e;
-  }
-  auto t2 = std::chrono::high_resolution_clock::now();
-  auto diff =
-      std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+  auto samples = collect_samples(policy, [&]() {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int64_t i = 0; i < iterations; i++) {
+      x = a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a + b + c +
+          d + e + a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a +
+          b + c + d + e + a + b + c + d + e + a + b + c + d + e;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1)
+        .count();
+  });
+  auto diff = summarize(std::move(samples)).median;
   auto flops = ((double)(iterations * 49)) / ((double)(diff / 1e9));
   return (flops / 1e9);
 }
 
-int main() {
-  double gflops = measure_flops();
-  double mips = measure_mips();
+int main(int argc, char **argv) {
+  CLI::App app{"CPU throughput benchmark"};
+  argv = app.ensure_utf8(argv);
 
-  std::cout << "GFLOPS: " << gflops << std::endl;
-  std::cout << "MIPS: " << mips << std::endl;
+  int64_t iterations = 1024 * 1024 * 1024;
+  SamplingPolicy policy;
+  policy.iterations = 1;
+  app.add_option("-n,--loop-iterations", iterations,
+                 "Loop iterations per sample");
+  app.add_option("-i,--iterations", policy.iterations,
+                 "Samples per measurement (minimum with --ci, unless --budget "
+                 "runs out first)");
+  app.add_option("--ci", policy.target_rel_ci,
+                 "Sample until the relative 95% CI is below this (e.g. 0.02)");
+  app.add_option("--budget", policy.budget_s,
+                 "Time budget in seconds per measurement with --ci");
+
+  std::string csv_path, json_path;
+  app.add_option("--csv", csv_path,
+                 "Append results as CSV to this file (- for stdout)");
+  app.add_option("--json", json_path,
+                 "Append results as JSON lines to this file (- for stdout)");
+
+  CLI11_PARSE(app, argc, argv);
+
+  ResultWriter writer(collect_metadata("perf_cpu", argc, argv));
+  if (!csv_path.empty())
+    writer.open_csv(csv_path);
+  if (!json_path.empty())
+    writer.open_json(json_path);
+
+  double gflops = measure_flops(iterations, policy);
+  double mips = measure_mips(iterations, policy);
+
+  if (!writer.writes_stdout()) {
+    std::cout << "GFLOPS: " << gflops << std::endl;
+    std::cout << "MIPS: " << mips << std::endl;
+  }
+  writer.write("throughput", {"GFLOPS", "MIPS", "Loop iterations"}, gflops,
+               mips, iterations);
 }
@@ -1,79 +1,879 @@
+#include "CLI11.hpp"
+#include "VariadicTable.hpp"
+#include "cache.hpp"
+#include "pages.hpp"
+#include "placement.hpp"
+#include "report.hpp"
+#include "rng.hpp"
+#include "scaling.hpp"
+#include "stats.hpp"
+#include "stream.hpp"
+#include "sweep.hpp"
+#include <cctype>
 #include <chrono>
 #include <immintrin.h>
 #include <iostream>
-#include <math.h>
+#include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
-#define CACHE_LINE_SIZE 16
+constexpr size_t CACHE_LINE_BYTES = 64;
 
-void read_c(std::vector<std::vector<int32_t>> &v) {
-  for (int32_t i = 0; i < v.size(); i++) {
-    for (int32_t j = 0; j < CACHE_LINE_SIZE; j++) {
-      v[i][j] = v[i][j] + 1;
+// A single 64-byte aligned buffer viewed as `rows` rows of `row_len`
+// elements of `elem_size` bytes, rows back to back. The traversals touch
+// every `stride`-th element of each row.
+struct Layout {
+  size_t rows = 0;
+  size_t row_len = 16;
+  size_t elem_size = 4;
+  size_t stride = 1;
+
+  size_t pitch() const { return row_len * elem_size; }
+  size_t bytes() const { return rows * pitch(); }
+  size_t accesses() const { return rows * ((row_len + stride - 1) / stride); }
+};
+
+using Buffer = std::vector<uint8_t, AlignedAllocator<uint8_t>>;
+
+// Software prefetch hints. `w` is prefetchw: fetch the line in exclusive
+// state ahead of a store.
+enum class PrefetchHint { none, t0, t1, t2, nta, w };
+
+static std::string prefetch_hint_name(PrefetchHint h) {
+  switch (h) {
+  case PrefetchHint::none:
+    return "none";
+  case PrefetchHint::t0:
+    return "T0";
+  case PrefetchHint::t1:
+    return "T1";
+  case PrefetchHint::t2:
+    return "T2";
+  case PrefetchHint::nta:
+    return "NTA";
+  case PrefetchHint::w:
+    return "W";
+  }
+  return "?";
+}
+
+template <PrefetchHint H> static inline void prefetch_line(void const *p) {
+  auto c = static_cast<char const *>(p);
+  if constexpr (H == PrefetchHint::t0)
+    _mm_prefetch(c, _MM_HINT_T0);
+  else if constexpr (H == PrefetchHint::t1)
+    _mm_prefetch(c, _MM_HINT_T1);
+  else if constexpr (H == PrefetchHint::t2)
+    _mm_prefetch(c, _MM_HINT_T2);
+  else if constexpr (H == PrefetchHint::nta)
+    _mm_prefetch(c, _MM_HINT_NTA);
+  else if constexpr (H == PrefetchHint::w)
+    // prefetchw where PRFCHW is enabled (it is for sapphirerapids).
+    __builtin_prefetch(p, 1, 3);
+}
+
+// Prefetches a stream of addresses, at most once per cache line.
+template <PrefetchHint H> struct LinePrefetcher {
+  uintptr_t last = ~uintptr_t(0);
+
+  void operator()(void const *p) {
+    uintptr_t line = reinterpret_cast<uintptr_t>(p) / CACHE_LINE_BYTES;
+    if (line != last) {
+      prefetch_line<H>(p);
+      last = line;
+    }
+  }
+};
+
+// Calls fn(std::integral_constant<PrefetchHint, h>{}).
+template <typename Fn> void with_hint(PrefetchHint h, Fn &&fn) {
+  using enum PrefetchHint;
+  switch (h) {
+  case none:
+    return fn(std::integral_constant<PrefetchHint, none>{});
+  case t0:
+    return fn(std::integral_constant<PrefetchHint, t0>{});
+  case t1:
+    return fn(std::integral_constant<PrefetchHint, t1>{});
+  case t2:
+    return fn(std::integral_constant<PrefetchHint, t2>{});
+  case nta:
+    return fn(std::integral_constant<PrefetchHint, nta>{});
+  case w:
+    return fn(std::integral_constant<PrefetchHint, w>{});
+  }
+}
+
+// Row by row: consecutive accesses are `stride` elements apart. With a
+// hint, the element `distance` accesses ahead is prefetched inline, once
+// per cache line's worth of accesses so the inner loop stays vectorizable.
+template <typename T, PrefetchHint H = PrefetchHint::none>
+void read_c(uint8_t *buf, Layout const &l, size_t distance = 0) {
+  if constexpr (H == PrefetchHint::none) {
+    for (size_t i = 0; i < l.rows; i++) {
+      T *row = reinterpret_cast<T *>(buf + i * l.pitch());
+      for (size_t j = 0; j < l.row_len; j += l.stride) {
+        row[j] = row[j] + 1;
+      }
+    }
+  } else {
+    // Rows are back to back, so the access `distance` ahead is this many
+    // bytes further on (exactly so when `stride` divides the row).
+    size_t ahead = distance * l.stride * sizeof(T);
+    size_t limit = l.bytes();
+    size_t per_line = std::max<size_t>(CACHE_LINE_BYTES / sizeof(T), 1);
+    size_t chunk = (per_line + l.stride - 1) / l.stride * l.stride;
+    for (size_t i = 0; i < l.rows; i++) {
+      T *row = reinterpret_cast<T *>(buf + i * l.pitch());
+      for (size_t j0 = 0; j0 < l.row_len; j0 += chunk) {
+        size_t target = i * l.pitch() + j0 * sizeof(T) + ahead;
+        if (target < limit)
+          prefetch_line<H>(buf + target);
+        size_t j1 = std::min(j0 + chunk, l.row_len);
+        for (size_t j = j0; j < j1; j += l.stride) {
+          row[j] = row[j] + 1;
+        }
+      }
     }
   }
 }
 
-void read_cu(std::vector<std::vector<int32_t>> &v) {
-  for (int32_t j = 0; j < CACHE_LINE_SIZE; j++) {
-    for (int32_t i = 0; i < v.size(); i++) {
-      v[i][j] = v[i][j] + 1;
+// Column by column: consecutive accesses are a row pitch apart.
+template <typename T, PrefetchHint H = PrefetchHint::none>
+void read_cu(uint8_t *buf, Layout const &l, size_t distance = 0) {
+  size_t pi = 0, pj = 0;
+  auto advance = [&]() {
+    if (++pi == l.rows) {
+      pi = 0;
+      pj += l.stride;
+    }
+  };
+  LinePrefetcher<H> pf;
+  if constexpr (H != PrefetchHint::none) {
+    for (size_t k = 0; k < distance && pj < l.row_len; k++)
+      advance();
+  }
+  for (size_t j = 0; j < l.row_len; j += l.stride) {
+    for (size_t i = 0; i < l.rows; i++) {
+      if constexpr (H != PrefetchHint::none) {
+        if (pj < l.row_len) {
+          pf(buf + pi * l.pitch() + pj * sizeof(T));
+          advance();
+        }
+      }
+      T *row = reinterpret_cast<T *>(buf + i * l.pitch());
+      row[j] = row[j] + 1;
     }
   }
 }
 
-int main(int argc, char *argv[]) {
-  int32_t n = atoi(argv[1]);
+// The first element of every cache line, lines in the order of `lines`.
+// The hardware prefetchers cannot follow this one.
+template <typename T, PrefetchHint H = PrefetchHint::none>
+void read_random(uint8_t *buf, std::vector<uint32_t> const &lines,
+                 size_t distance = 0) {
+  size_t n = lines.size();
+  for (size_t k = 0; k < n; k++) {
+    if constexpr (H != PrefetchHint::none) {
+      if (k + distance < n)
+        prefetch_line<H>(buf + size_t(lines[k + distance]) * CACHE_LINE_BYTES);
+    }
+    T *p = reinterpret_cast<T *>(buf + size_t(lines[k]) * CACHE_LINE_BYTES);
+    *p = *p + 1;
+  }
+}
+
+// Calls fn(T{}) with the unsigned type of `elem_size` bytes.
+template <typename Fn> void with_elem_type(size_t elem_size, Fn &&fn) {
+  switch (elem_size) {
+  case 1:
+    return fn(uint8_t{});
+  case 2:
+    return fn(uint16_t{});
+  case 4:
+    return fn(uint32_t{});
+  case 8:
+    return fn(uint64_t{});
+  }
+  throw std::invalid_argument("element size must be 1, 2, 4 or 8");
+}
 
-  std::vector<std::vector<int32_t>> v(n, std::vector<int32_t>(16, 0));
-  for (int32_t i = 0; i < n; i++) {
-    for (int32_t j = 0; j < CACHE_LINE_SIZE; j++) {
-      v[i][j] = i + j;
+template <typename Fn> int64_t time_ns(Fn &&fn) {
+  auto t1 = std::chrono::high_resolution_clock::now();
+  fn();
+  auto t2 = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+}
+
+void report(std::string const &label, std::vector<int64_t> samples,
+            Layout const &l, ResultWriter &writer) {
+  double ci = relative_ci(samples);
+  auto st = summarize(std::move(samples));
+  double ns_per_access = st.median / l.accesses();
+  if (!writer.writes_stdout()) {
+    std::cout << "time to read " << label << ": " << st.median / 1e3 << " us"
+              << ", " << ns_per_access << " ns/access"
+              << " (min " << st.min / 1e3 << " us, " << st.samples.size()
+              << " samples, 95% CI +/-" << ci * 100 << "%)" << std::endl;
+  }
+  writer.write("read",
+               {"Experiment", "Rows", "Row length", "Element size (B)",
+                "Stride", "Bytes", "Median (ns)", "Min (ns)", "ns/access",
+                "Samples", "Relative CI"},
+               label, (uint64_t)l.rows, (uint64_t)l.row_len,
+               (uint64_t)l.elem_size, (uint64_t)l.stride, (uint64_t)l.bytes(),
+               st.median, st.min, ns_per_access, (uint64_t)st.samples.size(),
+               ci);
+}
+
+// Loads chased per latency sample, independent of the working set so the
+// largest sets do not take minutes.
+constexpr size_t CHASE_LOADS = size_t(1) << 22;
+// Bytes read per bandwidth sample; small sets are read repeatedly.
+constexpr size_t BANDWIDTH_BYTES = size_t(64) << 20;
+
+// Pointer-chase orders. Global visits the lines of the whole set in random
+// order, so nearly every load also lands on a new page; page-local visits
+// the 4 KiB pages in sequence and only randomizes the lines within each,
+// which keeps the TLB miss rate to one per 64 loads.
+enum class ChaseOrder { global, page_local };
+
+constexpr size_t CHASE_PAGE_BYTES = 4096;
+
+static std::string chase_order_name(ChaseOrder order) {
+  return order == ChaseOrder::global ? "global" : "page-local";
+}
+
+// Links the cache lines of buf[0, bytes) into a single cycle in `order`:
+// the first word of each line points at the next line to load. Random
+// order defeats the hardware prefetchers. Returns the start of the cycle.
+static void *build_chase(uint8_t *buf, size_t bytes, uint64_t seed,
+                         ChaseOrder order = ChaseOrder::global) {
+  size_t lines = bytes / CACHE_LINE_BYTES;
+  auto slot = [&](size_t i) {
+    return reinterpret_cast<uint64_t *>(buf + i * CACHE_LINE_BYTES);
+  };
+  uint64_t key = rng_key(seed);
+  if (order == ChaseOrder::global) {
+    // Sattolo's algorithm yields a permutation that is one cycle.
+    for (size_t i = 0; i < lines; i++)
+      *slot(i) = i;
+    for (size_t i = lines - 1; i > 0; i--) {
+      size_t j = splitmix64(key + i * SPLITMIX_GOLDEN) % i;
+      std::swap(*slot(i), *slot(j));
+    }
+    for (size_t i = 0; i < lines; i++)
+      *slot(i) = reinterpret_cast<uint64_t>(buf + *slot(i) * CACHE_LINE_BYTES);
+    return buf;
+  }
+
+  // A Fisher-Yates shuffle of each page's lines, chained page after page.
+  size_t per_page = CHASE_PAGE_BYTES / CACHE_LINE_BYTES;
+  std::vector<size_t> perm(per_page);
+  uint64_t *prev = nullptr;
+  void *first = nullptr;
+  for (size_t begin = 0; begin < lines; begin += per_page) {
+    size_t n = std::min(per_page, lines - begin);
+    for (size_t i = 0; i < n; i++)
+      perm[i] = begin + i;
+    for (size_t i = n - 1; i > 0; i--) {
+      size_t j = splitmix64(key + (begin + i) * SPLITMIX_GOLDEN) % (i + 1);
+      std::swap(perm[i], perm[j]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      uint64_t *line = slot(perm[i]);
+      if (prev)
+        *prev = reinterpret_cast<uint64_t>(line);
+      else
+        first = line;
+      prev = line;
     }
   }
+  *prev = reinterpret_cast<uint64_t>(first);
+  return first;
+}
+
+static void *chase(void *p, size_t loads) {
+  for (size_t i = 0; i < loads; i++)
+    p = *static_cast<void **>(p);
+  return p;
+}
+
+// Median ns per dependent load around the cycle over buf[0, bytes).
+static double chase_latency_ns(uint8_t *buf, size_t bytes, ChaseOrder order,
+                               SamplingPolicy const &policy,
+                               size_t *samples = nullptr) {
+  void *p = build_chase(buf, bytes, bytes, order);
+  p = chase(p, CHASE_LOADS);
+  auto st = summarize(collect_samples(policy, [&]() {
+    return time_ns([&]() { p = chase(p, CHASE_LOADS); });
+  }));
+  // Keeps the chase from being optimized away.
+  volatile uintptr_t sink = reinterpret_cast<uintptr_t>(p);
+  (void)sink;
+  if (samples)
+    *samples = st.samples.size();
+  return st.median / CHASE_LOADS;
+}
+
+static uint64_t read_words(uint64_t const *p, size_t words) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < words; i++)
+    sum += p[i];
+  return sum;
+}
+
+// Latency and read bandwidth for each working-set size, then the cache
+// levels inferred from the latency curve next to what sysfs reports.
+// Whole cache lines, at least two, ascending and without duplicates.
+static std::vector<uint64_t> working_set_sizes(std::string const &spec) {
+  auto sizes = parse_range(spec, true);
+  for (auto &s : sizes)
+    s = std::max<uint64_t>(s / CACHE_LINE_BYTES, 2) * CACHE_LINE_BYTES;
+  std::sort(sizes.begin(), sizes.end());
+  sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+  if (sizes.empty())
+    throw std::invalid_argument("empty working-set range");
+  return sizes;
+}
+
+static void working_set_sweep(std::vector<uint64_t> const &sizes,
+                              SamplingPolicy const &policy,
+                              ResultWriter &writer) {
+  // Transparent huge pages, so that TLB misses do not show up as an extra
+  // cache level.
+  Buffer buf(sizes.back(), AlignedAllocator<uint8_t>(PageMode::thp));
+  volatile uint64_t sink = 0;
+
+  std::vector<WorkingSetRow> rows;
+  for (uint64_t bytes : sizes) {
+    WorkingSetRow row;
+    row.bytes = bytes;
+
+    size_t samples = 0;
+    row.latency_ns = chase_latency_ns(buf.data(), bytes, ChaseOrder::global,
+                                      policy, &samples);
 
-  int32_t bytes = n * sizeof(int32_t);
-  std::cout << "size of v (KiB): " << ((double)(bytes) / (1024)) << " KiB"
-            << std::endl;
-  std::cout << "size of v (MiB): " << ((double)(bytes) / (1024 * 1024))
-            << " MiB" << std::endl;
-
-  for (int32_t r = 0; r < 5; r++) {
-    auto t1 = std::chrono::high_resolution_clock::now();
-    read_c(v);
-    auto t2 = std::chrono::high_resolution_clock::now();
-    auto diff =
-        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "time to read cache friendly: " << diff << " us" << std::endl;
-
-    t1 = std::chrono::high_resolution_clock::now();
-    read_cu(v);
-    t2 = std::chrono::high_resolution_clock::now();
-    auto diff2 =
-        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "time to read cache unfriendly: " << diff2 << " us"
+    auto words = reinterpret_cast<uint64_t const *>(buf.data());
+    size_t passes = std::max<size_t>(BANDWIDTH_BYTES / bytes, 1);
+    sink = read_words(words, bytes / sizeof(uint64_t));
+    auto bw = summarize(collect_samples(policy, [&]() {
+      return time_ns([&]() {
+        for (size_t i = 0; i < passes; i++)
+          sink = read_words(words, bytes / sizeof(uint64_t));
+      });
+    }));
+    row.bandwidth_gbs = (double)bytes * passes / bw.median;
+
+    writer.write("working_set",
+                 {"Bytes", "Latency (ns)", "Bandwidth (GB/s)", "Samples"},
+                 (uint64_t)bytes, row.latency_ns, row.bandwidth_gbs,
+                 (uint64_t)samples);
+    rows.push_back(row);
+  }
+  (void)sink;
+
+  auto levels = infer_cache_levels(rows);
+  for (auto const &l : levels)
+    writer.write("cache_levels",
+                 {"Level", "Measured bytes", "Latency (ns)",
+                  "Bandwidth (GB/s)", "Sysfs bytes"},
+                 l.name, (uint64_t)l.bytes, l.latency_ns, l.bandwidth_gbs,
+                 (uint64_t)l.sysfs_bytes);
+  if (writer.writes_stdout())
+    return;
+
+  VariadicTable<std::string, double, double> table(
+      {"Working set", "Latency (ns)", "Bandwidth (GB/s)"});
+  for (auto const &r : rows)
+    table.addRow(format_bytes(r.bytes), r.latency_ns, r.bandwidth_gbs);
+  table.print(std::cout);
+
+  // The measured size is the last one swept before the steepest step of
+  // the rise, so with x2 steps it can read up to half the real size.
+  VariadicTable<std::string, std::string, double, double, std::string,
+                std::string>
+      ltable({"Level", "Measured", "Latency (ns)", "Bandwidth (GB/s)",
+              "Sysfs", "Measured / sysfs"});
+  for (auto const &l : levels) {
+    std::string sysfs = l.sysfs_bytes ? format_bytes(l.sysfs_bytes) : "-";
+    std::string ratio = "-";
+    if (l.sysfs_bytes) {
+      char buf[32];
+      std::snprintf(buf, sizeof(buf), "%.2f", (double)l.bytes / l.sysfs_bytes);
+      ratio = buf;
+    }
+    ltable.addRow(l.name, format_bytes(l.bytes), l.latency_ns,
+                  l.bandwidth_gbs, sysfs, ratio);
+  }
+  ltable.print(std::cout);
+}
+
+// Runs infer_cache_levels on synthetic curves against a fixed hierarchy
+// (48 KiB L1, 2 MiB L2, 16 MiB L3): one with three cache plateaus, the
+// last two transitions back to back and a small bump inside L2 that must
+// not count as a level; one where the L2 climb spreads over several sizes
+// and no L3 plateau shows up, so the outermost plateau is DRAM.
+static bool cache_inference_self_test() {
+  std::vector<CacheLevel> caches = {
+      {1, "Data", 48 << 10}, {2, "Unified", 2 << 20}, {3, "Unified", 16 << 20}};
+  struct Case {
+    std::vector<std::pair<uint64_t, double>> curve;
+    std::vector<std::pair<std::string, uint64_t>> expected;
+  };
+  std::vector<Case> cases = {
+      {{{4 << 10, 1.2},   {8 << 10, 1.2},    {16 << 10, 1.2},
+        {32 << 10, 1.2},  {64 << 10, 3.0},   {128 << 10, 4.0},
+        {256 << 10, 4.0}, {512 << 10, 4.5},  {1 << 20, 4.6},
+        {2 << 20, 8.0},   {4 << 20, 12.0},   {8 << 20, 30.0},
+        {16 << 20, 80.0}, {32 << 20, 90.0},  {64 << 20, 91.0}},
+       {{"L1", 32 << 10}, {"L2", 1 << 20}, {"L3", 8 << 20},
+        {"DRAM", 64 << 20}}},
+      {{{4 << 10, 2.0},    {8 << 10, 2.1},    {16 << 10, 2.1},
+        {32 << 10, 2.2},   {64 << 10, 6.5},   {128 << 10, 6.6},
+        {256 << 10, 6.5},  {512 << 10, 7.2},  {1 << 20, 8.3},
+        {2 << 20, 14.0},   {4 << 20, 140.0},  {8 << 20, 156.0},
+        {16 << 20, 165.0}, {32 << 20, 173.0}, {64 << 20, 166.0},
+        {128 << 20, 192.0}, {256 << 20, 207.0}},
+       {{"L1", 32 << 10}, {"L2", 2 << 20}, {"DRAM", 256 << 20}}}};
+
+  bool all_ok = true;
+  for (auto const &c : cases) {
+    std::vector<WorkingSetRow> rows;
+    for (auto [bytes, ns] : c.curve)
+      rows.push_back({bytes, ns, 0});
+    auto levels = infer_cache_levels(rows, caches);
+    bool ok = levels.size() == c.expected.size();
+    for (size_t i = 0; ok && i < levels.size(); i++)
+      ok = levels[i].name == c.expected[i].first &&
+           levels[i].bytes == c.expected[i].second;
+    for (auto const &l : levels)
+      std::cout << l.name << ": " << format_bytes(l.bytes) << std::endl;
+    std::cout << "cache level inference: " << (ok ? "ok" : "FAILED")
               << std::endl;
+    all_ok &= ok;
+  }
+  return all_ok;
+}
+
+// ns per dependent load for each working set, chasing in global and
+// page-local order over 4 KiB pages and over `huge` pages. With huge pages
+// the global chase misses the TLB far less often, so the gap between the
+// two global columns is the TLB miss cost and the page-local columns are
+// close to the pure cache miss cost.
+static void pointer_chase_sweep(std::vector<uint64_t> const &sizes,
+                                PageMode huge, SamplingPolicy const &policy,
+                                ResultWriter &writer) {
+  PageMode modes[] = {PageMode::small, huge};
+  ChaseOrder orders[] = {ChaseOrder::global, ChaseOrder::page_local};
+  // ns[mode][order][size]
+  std::vector<double> ns[2][2];
+  for (int m = 0; m < 2; m++) {
+    // One mapping per page size at a time keeps the peak footprint to the
+    // largest working set.
+    Buffer buf(sizes.back(), AlignedAllocator<uint8_t>(modes[m]));
+    for (int o = 0; o < 2; o++) {
+      for (uint64_t bytes : sizes) {
+        size_t samples = 0;
+        double lat =
+            chase_latency_ns(buf.data(), bytes, orders[o], policy, &samples);
+        ns[m][o].push_back(lat);
+        writer.write("chase",
+                     {"Order", "Pages", "Bytes", "ns/load", "Samples"},
+                     chase_order_name(orders[o]), page_mode_name(modes[m]),
+                     (uint64_t)bytes, lat, (uint64_t)samples);
+      }
+    }
+  }
+  if (writer.writes_stdout())
+    return;
+
+  std::string h = page_mode_name(huge);
+  VariadicTable<std::string, double, double, double, double, double> table(
+      {"Working set", "Global 4K", "Page-local 4K", "Global " + h,
+       "Page-local " + h, "TLB (ns)"});
+  for (size_t i = 0; i < sizes.size(); i++)
+    table.addRow(format_bytes(sizes[i]), ns[0][0][i], ns[0][1][i],
+                 ns[1][0][i], ns[1][1][i], ns[0][0][i] - ns[1][0][i]);
+  table.print(std::cout);
+}
 
-    for (int32_t i = 0; i < v.size(); i++) {
-      _mm_prefetch(&v[i][0], _MM_HINT_T0);
+// Where a STREAM run's threads execute and where its arrays live.
+struct StreamConfig {
+  std::string name;
+  // Threads are pinned to these CPUs in order.
+  std::vector<int> cpus;
+  Placement placement;
+};
+
+// Threads and memory on each node, threads on each node reading the next
+// node's memory, and all nodes with first-touch (local) memory. On a
+// single-node machine only the first remains.
+static std::vector<StreamConfig> stream_configs() {
+  auto by_node = allowed_cpus_by_node();
+  int nodes = by_node.size();
+  std::vector<StreamConfig> configs;
+  for (int node = 0; node < nodes; node++) {
+    if (!by_node[node].empty())
+      configs.push_back({"node " + std::to_string(node), by_node[node],
+                         {NumaPolicy::bind, node}});
+  }
+  if (nodes < 2)
+    return configs;
+  for (int node = 0; node < nodes; node++) {
+    int mem = (node + 1) % nodes;
+    if (!by_node[node].empty())
+      configs.push_back({"node " + std::to_string(node) + " -> mem " +
+                             std::to_string(mem),
+                         by_node[node], {NumaPolicy::bind, mem}});
+  }
+  // Alternating nodes, so every thread count is spread evenly.
+  StreamConfig all{"all nodes", {}, {NumaPolicy::first_touch}};
+  for (size_t i = 0;; i++) {
+    size_t before = all.cpus.size();
+    for (auto &cpus : by_node) {
+      if (i < cpus.size())
+        all.cpus.push_back(cpus[i]);
     }
+    if (all.cpus.size() == before)
+      break;
+  }
+  configs.push_back(all);
+  return configs;
+}
+
+// GB/s of every STREAM kernel for each configuration and thread count
+// (`threads_spec`, by default 1, 2, 4, ... up to the configuration's CPUs).
+static void stream_sweep(size_t array_bytes, std::string const &threads_spec,
+                         SamplingPolicy const &policy, ResultWriter &writer) {
+  size_t n = array_bytes / sizeof(double);
+  if (n == 0)
+    throw std::invalid_argument("STREAM arrays must hold at least one double");
 
-    t1 = std::chrono::high_resolution_clock::now();
-    read_c(v);
-    t2 = std::chrono::high_resolution_clock::now();
-    auto diff3 =
-        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "time to read cache prefetch: " << diff3 << " us" << std::endl;
-
-    t1 = std::chrono::high_resolution_clock::now();
-    read_cu(v);
-    t2 = std::chrono::high_resolution_clock::now();
-    auto diff4 =
-        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "time to read cache unfriendly prefetch: " << diff4 << " us"
+  VariadicTable<std::string, int32_t, double, double, double, double, double,
+                double>
+      table({"Config", "Threads", "Copy", "Scale", "Add", "Triad", "Read",
+             "Write (NT)"});
+  for (auto const &config : stream_configs()) {
+    auto counts = threads_spec.empty()
+                      ? scaling_thread_counts(config.cpus.size())
+                      : parse_range(threads_spec);
+    // Bound pages must be placed before the first touch, and with
+    // first-touch placement the widest team initializes, so every later
+    // (smaller) team finds its chunk where that team left it.
+    StreamArrays s(n);
+    for (dvec *v : {&s.a, &s.b, &s.c})
+      place_memory(v->data(), n * sizeof(double), config.placement);
+    omp_set_num_threads(*std::max_element(counts.begin(), counts.end()));
+    pin_threads_to(config.cpus);
+    stream_init(s);
+
+    for (uint64_t t : counts) {
+      omp_set_num_threads(t);
+      pin_threads_to(config.cpus);
+      double gbs[std::size(STREAM_KERNELS)];
+      for (size_t k = 0; k < std::size(STREAM_KERNELS); k++) {
+        StreamKernel kernel = STREAM_KERNELS[k];
+        stream_run(kernel, s);
+        auto st = summarize(collect_samples(
+            policy, [&]() { return stream_run(kernel, s); }));
+        double bytes = (double)n * stream_kernel_bytes(kernel);
+        gbs[k] = bytes / st.min;
+        writer.write("stream",
+                     {"Config", "Kernel", "Threads", "Array bytes",
+                      "Best (GB/s)", "Median (GB/s)", "Samples"},
+                     config.name, stream_kernel_name(kernel), (uint64_t)t,
+                     (uint64_t)(n * sizeof(double)), gbs[k],
+                     bytes / st.median, (uint64_t)st.samples.size());
+      }
+      table.addRow(config.name, (int32_t)t, gbs[0], gbs[1], gbs[2], gbs[3],
+                   gbs[4], gbs[5]);
+    }
+  }
+  if (!writer.writes_stdout()) {
+    std::cout << "STREAM best GB/s, " << format_bytes(n * sizeof(double))
+              << " per array" << std::endl;
+    table.print(std::cout);
+  }
+}
+
+enum class AccessPattern { row_major, column_major, random_lines };
+
+static std::string access_pattern_name(AccessPattern p) {
+  switch (p) {
+  case AccessPattern::row_major:
+    return "row-major";
+  case AccessPattern::column_major:
+    return "column-major";
+  case AccessPattern::random_lines:
+    return "random lines";
+  }
+  return "?";
+}
+
+// For each working set and access pattern, ns per access without
+// prefetching and with every hint at every distance (in accesses), and
+// the best combination. Row- and column-major walk `base` reshaped to the
+// working set; random lines touches each line of it once in random order.
+static void prefetch_sweep(std::vector<uint64_t> const &sizes,
+                           Layout const &base,
+                           std::vector<PrefetchHint> const &hints,
+                           std::vector<uint64_t> const &distances,
+                           SamplingPolicy const &policy,
+                           ResultWriter &writer) {
+  VariadicTable<std::string, std::string, double, std::string, int32_t,
+                double, double>
+      table({"Pattern", "Working set", "No prefetch (ns)", "Best hint",
+             "Best distance", "Best (ns)", "Speedup"});
+  for (uint64_t bytes : sizes) {
+    Layout l = base;
+    l.rows = std::max<size_t>(bytes / l.pitch(), 1);
+    Buffer buf(l.bytes());
+    for (size_t i = 0; i < buf.size(); i++)
+      buf[i] = (uint8_t)i;
+    std::vector<uint32_t> lines(l.bytes() / CACHE_LINE_BYTES);
+    for (size_t i = 0; i < lines.size(); i++)
+      lines[i] = i;
+    uint64_t key = rng_key(bytes);
+    for (size_t i = lines.size(); i > 1; i--)
+      std::swap(lines[i - 1], lines[splitmix64(key + i * SPLITMIX_GOLDEN) % i]);
+
+    with_elem_type(l.elem_size, [&](auto t) {
+      using T = decltype(t);
+      for (auto pattern :
+           {AccessPattern::row_major, AccessPattern::column_major,
+            AccessPattern::random_lines}) {
+        if (pattern == AccessPattern::random_lines && lines.empty())
+          continue;
+        size_t accesses = pattern == AccessPattern::random_lines
+                              ? lines.size()
+                              : l.accesses();
+        // Median ns per access with hint `h` at `distance`.
+        auto measure = [&](auto h, size_t distance) {
+          constexpr PrefetchHint H = decltype(h)::value;
+          auto once = [&]() {
+            switch (pattern) {
+            case AccessPattern::row_major:
+              return read_c<T, H>(buf.data(), l, distance);
+            case AccessPattern::column_major:
+              return read_cu<T, H>(buf.data(), l, distance);
+            case AccessPattern::random_lines:
+              return read_random<T, H>(buf.data(), lines, distance);
+            }
+          };
+          once();
+          auto st = summarize(collect_samples(
+              policy, [&]() { return time_ns(once); }));
+          double ns = st.median / accesses;
+          writer.write("prefetch",
+                       {"Pattern", "Bytes", "Hint", "Distance", "ns/access",
+                        "Samples"},
+                       access_pattern_name(pattern), (uint64_t)l.bytes(),
+                       prefetch_hint_name(H), (uint64_t)distance, ns,
+                       (uint64_t)st.samples.size());
+          return ns;
+        };
+
+        double none = measure(
+            std::integral_constant<PrefetchHint, PrefetchHint::none>{}, 0);
+        double best = none;
+        PrefetchHint best_hint = PrefetchHint::none;
+        uint64_t best_distance = 0;
+        for (PrefetchHint hint : hints) {
+          for (uint64_t d : distances) {
+            double ns = 0;
+            with_hint(hint, [&](auto h) { ns = measure(h, d); });
+            if (ns < best) {
+              best = ns;
+              best_hint = hint;
+              best_distance = d;
+            }
+          }
+        }
+        table.addRow(access_pattern_name(pattern), format_bytes(l.bytes()),
+                     none, prefetch_hint_name(best_hint),
+                     (int32_t)best_distance, best, none / best);
+      }
+    });
+  }
+  if (!writer.writes_stdout())
+    table.print(std::cout);
+}
+
+int main(int argc, char *argv[]) {
+  CLI::App app{"Memory access benchmark"};
+  argv = app.ensure_utf8(argv);
+
+  Layout layout;
+  SamplingPolicy policy;
+  policy.iterations = 5;
+  app.add_option("n", layout.rows, "Number of rows")
+      ->check(CLI::PositiveNumber);
+  app.add_option("--row-length", layout.row_len, "Elements per row")
+      ->check(CLI::PositiveNumber);
+  app.add_option("--elem-size", layout.elem_size, "Element size in bytes")
+      ->check(CLI::IsMember({1, 2, 4, 8}));
+  app.add_option("--stride", layout.stride,
+                 "Elements between accesses within a row")
+      ->check(CLI::PositiveNumber);
+  app.add_option("-i,--iterations", policy.iterations,
+                 "Samples per experiment (minimum with --ci, unless --budget "
+                 "runs out first)");
+  app.add_option("--ci", policy.target_rel_ci,
+                 "Sample until the relative 95% CI is below this (e.g. 0.02)");
+  app.add_option("--budget", policy.budget_s,
+                 "Time budget in seconds per experiment with --ci");
+  bool working_set = false;
+  bool pointer_chase = false;
+  bool self_test = false;
+  std::string ws_sizes = "4K:2G:x2";
+  PageMode huge = PageMode::thp;
+  app.add_flag("--working-set", working_set,
+               "Sweep working-set sizes and infer the cache levels");
+  app.add_flag("--self-test", self_test,
+               "Check cache-level inference on a synthetic latency curve");
+  app.add_flag("--chase", pointer_chase,
+               "Pointer-chase latency per working-set size, global and "
+               "page-local, with 4K and huge pages");
+  app.add_option("--ws-sizes", ws_sizes,
+                 "Working-set sizes in bytes, K/M/G suffixes allowed")
+      ->capture_default_str();
+  size_t pf_distance = 16;
+  PrefetchHint pf_hint = PrefetchHint::t0;
+  bool pf_sweep = false;
+  std::string pf_hints = "t0,t1,t2,nta,w";
+  std::string pf_distances = "1:256:x2";
+  std::map<std::string, PrefetchHint> hint_names = {
+      {"t0", PrefetchHint::t0},   {"t1", PrefetchHint::t1},
+      {"t2", PrefetchHint::t2},   {"nta", PrefetchHint::nta},
+      {"w", PrefetchHint::w}};
+  app.add_option("--prefetch-distance", pf_distance,
+                 "Accesses ahead the prefetch experiments prefetch")
+      ->capture_default_str();
+  app.add_option("--prefetch-hint", pf_hint,
+                 "Hint of the prefetch experiments: t0, t1, t2, nta or w "
+                 "(prefetchw)")
+      ->transform(CLI::CheckedTransformer(hint_names, CLI::ignore_case));
+  app.add_flag("--prefetch-sweep", pf_sweep,
+               "Sweep prefetch hint and distance per access pattern and "
+               "working-set size (default sizes 32K:512M:x8)");
+  app.add_option("--prefetch-hints", pf_hints, "Hints for --prefetch-sweep")
+      ->capture_default_str();
+  app.add_option("--prefetch-distances", pf_distances,
+                 "Distances in accesses for --prefetch-sweep")
+      ->capture_default_str();
+  bool stream = false;
+  std::string stream_bytes, stream_threads;
+  app.add_flag("--stream", stream,
+               "STREAM kernels over 1..N pinned threads, per NUMA node and "
+               "across nodes");
+  app.add_option("--stream-bytes", stream_bytes,
+                 "Bytes per STREAM array (default: 4x the total L3, at "
+                 "least 256M)");
+  app.add_option("--stream-threads", stream_threads,
+                 "Thread counts for --stream, e.g. 1:48:x2 or 1,12,24,48");
+  std::map<std::string, PageMode> huge_modes = {{"thp", PageMode::thp},
+                                                {"2m", PageMode::huge_2m},
+                                                {"1g", PageMode::huge_1g}};
+  app.add_option("--huge-pages", huge, "Huge pages for --chase")
+      ->transform(CLI::CheckedTransformer(huge_modes, CLI::ignore_case));
+  std::string csv_path, json_path;
+  app.add_option("--csv", csv_path,
+                 "Append results as CSV to this file (- for stdout)");
+  app.add_option("--json", json_path,
+                 "Append results as JSON lines to this file (- for stdout)");
+
+  CLI11_PARSE(app, argc, argv);
+  if (self_test)
+    return cache_inference_self_test() ? 0 : 1;
+
+  ResultWriter writer(collect_metadata("perf_mem", argc, argv));
+  if (!csv_path.empty())
+    writer.open_csv(csv_path);
+  if (!json_path.empty())
+    writer.open_json(json_path);
+
+  if (working_set || pointer_chase || stream || pf_sweep) {
+    try {
+      if (pf_sweep) {
+        std::vector<PrefetchHint> hints;
+        for (auto name : parse_list(pf_hints)) {
+          for (auto &c : name)
+            c = std::tolower((unsigned char)c);
+          auto it = hint_names.find(name);
+          if (it == hint_names.end())
+            throw std::invalid_argument("unknown prefetch hint: " + name);
+          hints.push_back(it->second);
+        }
+        auto sizes =
+            working_set_sizes(app.count("--ws-sizes") ? ws_sizes : "32K:512M:x8");
+        prefetch_sweep(sizes, layout, hints, parse_range(pf_distances), policy,
+                       writer);
+      }
+      if (working_set || pointer_chase) {
+        auto sizes = working_set_sizes(ws_sizes);
+        if (working_set)
+          working_set_sweep(sizes, policy, writer);
+        if (pointer_chase)
+          pointer_chase_sweep(sizes, huge, policy, writer);
+      }
+      if (stream) {
+        // STREAM's rule: each array well beyond the last-level caches.
+        size_t bytes = std::max<size_t>(4 * cache_bytes(3) * numa_nodes(),
+                                        size_t(256) << 20);
+        if (!stream_bytes.empty())
+          bytes = parse_count(stream_bytes, true);
+        stream_sweep(bytes, stream_threads, policy, writer);
+      }
+    } catch (std::exception const &e) {
+      std::cerr << "error: " << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  if (layout.rows == 0) {
+    std::cerr << "error: n is required without --working-set, --chase, "
+                 "--stream or --prefetch-sweep"
               << std::endl;
+    return 1;
   }
 
+  Buffer v(layout.bytes());
+  for (size_t i = 0; i < v.size(); i++) {
+    v[i] = (uint8_t)i;
+  }
+
+  size_t bytes = layout.bytes();
+  if (!writer.writes_stdout()) {
+    std::cout << "size of v (KiB): " << ((double)(bytes) / (1024)) << " KiB"
+              << std::endl;
+    std::cout << "size of v (MiB): " << ((double)(bytes) / (1024 * 1024))
+              << " MiB" << std::endl;
+    std::cout << "row pitch: " << layout.pitch() << " B, access stride: "
+              << layout.stride * layout.elem_size << " B" << std::endl;
+  }
+
+  with_elem_type(layout.elem_size, [&](auto t) {
+    using T = decltype(t);
+    uint8_t *buf = v.data();
+    report("cache friendly", collect_samples(policy, [&]() {
+             return time_ns([&]() { read_c<T>(buf, layout); });
+           }), layout, writer);
+    report("cache unfriendly", collect_samples(policy, [&]() {
+             return time_ns([&]() { read_cu<T>(buf, layout); });
+           }), layout, writer);
+    with_hint(pf_hint, [&](auto h) {
+      report("cache prefetch", collect_samples(policy, [&]() {
+               return time_ns(
+                   [&]() { read_c<T, h.value>(buf, layout, pf_distance); });
+             }), layout, writer);
+      report("cache unfriendly prefetch", collect_samples(policy, [&]() {
+               return time_ns(
+                   [&]() { read_cu<T, h.value>(buf, layout, pf_distance); });
+             }), layout, writer);
+    });
+  });
+
   return 0;
 }
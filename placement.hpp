@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <numa.h>
+#include <omp.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// NUMA placement of benchmark buffers and OpenMP thread pinning. Everything
+// here is a no-op when libnuma reports NUMA as unavailable or the machine
+// has a single node.
+
+enum class NumaPolicy {
+  // Pages go wherever they are first touched.
+  first_touch,
+  // Pages are interleaved round-robin across all nodes.
+  interleave,
+  // Pages are bound to `Placement::node`.
+  bind,
+  // Host inputs are copied to every node. The sharded inner product gives
+  // each node's workers their own copy; everything else runs on the calling
+  // thread, so it reads that thread's copy and the policy amounts to binding
+  // inputs to its node. Library buffers are bound to the calling thread's
+  // node.
+  replicate,
+};
+
+enum class ThreadPinning { none, compact, scatter };
+
+struct Placement {
+  NumaPolicy policy = NumaPolicy::first_touch;
+  int node = 0;
+  ThreadPinning pinning = ThreadPinning::none;
+};
+
+static int numa_nodes() {
+  if (numa_available() < 0)
+    return 1;
+  return std::max(1, numa_num_configured_nodes());
+}
+
+static int current_numa_node() {
+  if (numa_available() < 0)
+    return 0;
+  return std::max(0, numa_node_of_cpu(sched_getcpu()));
+}
+
+inline std::string placement_name(Placement const &pl) {
+  std::string s;
+  switch (pl.policy) {
+  case NumaPolicy::first_touch:
+    s = "first-touch";
+    break;
+  case NumaPolicy::interleave:
+    s = "interleave";
+    break;
+  case NumaPolicy::bind:
+    s = "bind:" + std::to_string(pl.node);
+    break;
+  case NumaPolicy::replicate:
+    s = "replicate";
+    break;
+  }
+  switch (pl.pinning) {
+  case ThreadPinning::none:
+    break;
+  case ThreadPinning::compact:
+    s += "/compact";
+    break;
+  case ThreadPinning::scatter:
+    s += "/scatter";
+    break;
+  }
+  return s;
+}
+
+// Applies `pl` to the whole pages inside [p, p + bytes). Must be called
+// before the pages are first written to take effect without migration.
+static void place_memory(void *p, size_t bytes, Placement const &pl) {
+  if (pl.policy == NumaPolicy::first_touch || numa_nodes() < 2)
+    return;
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (reinterpret_cast<uintptr_t>(p) + page - 1) & ~(page - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(p) + bytes) & ~(page - 1);
+  if (end <= start)
+    return;
+  void *aligned = reinterpret_cast<void *>(start);
+  switch (pl.policy) {
+  case NumaPolicy::interleave:
+    numa_interleave_memory(aligned, end - start, numa_all_nodes_ptr);
+    break;
+  case NumaPolicy::bind:
+    numa_tonode_memory(aligned, end - start, pl.node);
+    break;
+  case NumaPolicy::replicate:
+    numa_tonode_memory(aligned, end - start, current_numa_node());
+    break;
+  default:
+    break;
+  }
+}
+
+// One copy of a host buffer per NUMA node. Each copy is allocated and
+// written by a thread running on its node, all nodes at once.
+template <typename T> class NodeReplicas {
+public:
+  NodeReplicas(T const *src, size_t n) : n(n) {
+    int nodes = numa_nodes();
+    if (nodes < 2) {
+      // 64-byte aligned like numa_alloc_onnode's pages, so the copy can
+      // still be wrapped without copying; aligned_alloc wants whole
+      // multiples of the alignment.
+      size_t bytes = std::max<size_t>(64, (n * sizeof(T) + 63) / 64 * 64);
+      T *copy = static_cast<T *>(std::aligned_alloc(64, bytes));
+      if (!copy)
+        throw std::bad_alloc();
+      std::memcpy(copy, src, n * sizeof(T));
+      copies.push_back(copy);
+      return;
+    }
+    copies.assign(nodes, nullptr);
+    std::vector<std::thread> threads;
+    for (int node = 0; node < nodes; node++) {
+      threads.emplace_back([this, src, node]() {
+        numa_run_on_node(node);
+        size_t bytes = this->n * sizeof(T);
+        T *copy = static_cast<T *>(numa_alloc_onnode(bytes, node));
+        if (copy)
+          std::memcpy(copy, src, bytes);
+        copies[node] = copy;
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+    if (std::find(copies.begin(), copies.end(), nullptr) != copies.end()) {
+      for (T *copy : copies) {
+        if (copy)
+          numa_free(copy, n * sizeof(T));
+      }
+      throw std::bad_alloc();
+    }
+  }
+  NodeReplicas(NodeReplicas const &) = delete;
+  NodeReplicas &operator=(NodeReplicas const &) = delete;
+  ~NodeReplicas() {
+    for (T *copy : copies) {
+      if (copies.size() > 1)
+        numa_free(copy, n * sizeof(T));
+      else
+        std::free(copy);
+    }
+  }
+
+  T *on(int node) const { return copies[node % copies.size()]; }
+  T *local() const { return on(current_numa_node()); }
+
+private:
+  size_t n;
+  std::vector<T *> copies;
+};
+
+// CPUs of the process affinity mask, grouped by NUMA node.
+static std::vector<std::vector<int>> allowed_cpus_by_node() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    throw std::runtime_error("sched_getaffinity failed.");
+  std::vector<std::vector<int>> by_node(numa_nodes());
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+    int node = numa_available() < 0 ? 0 : std::max(0, numa_node_of_cpu(cpu));
+    by_node[node % by_node.size()].push_back(cpu);
+  }
+  return by_node;
+}
+
+// Pins OpenMP thread t of the current team size to cpus[t % cpus.size()].
+// Returns the CPU chosen for each thread.
+static std::vector<int> pin_threads_to(std::vector<int> const &order) {
+  std::vector<int> cpus(omp_get_max_threads());
+  if (order.empty())
+    return {};
+#pragma omp parallel
+  {
+    int t = omp_get_thread_num();
+    int cpu = order[t % order.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+    cpus[t] = cpu;
+  }
+  return cpus;
+}
+
+// Pins every OpenMP thread to one CPU of the process affinity mask.
+// `compact` fills a node before moving to the next, `scatter` alternates
+// between nodes. Returns the CPU chosen for each thread.
+inline std::vector<int> pin_threads(ThreadPinning pinning) {
+  if (pinning == ThreadPinning::none)
+    return {};
+
+  auto by_node = allowed_cpus_by_node();
+  size_t total = 0;
+  for (auto &node_cpus : by_node)
+    total += node_cpus.size();
+
+  std::vector<int> order;
+  if (pinning == ThreadPinning::compact) {
+    for (auto &node_cpus : by_node)
+      order.insert(order.end(), node_cpus.begin(), node_cpus.end());
+  } else {
+    for (size_t i = 0; order.size() < total; i++) {
+      for (auto &node_cpus : by_node) {
+        if (i < node_cpus.size())
+          order.push_back(node_cpus[i]);
+      }
+    }
+  }
+  return pin_threads_to(order);
+}
+
+// One persistent thread per NUMA node, running on that node's CPUs. OpenMP
+// gives every such thread its own team, so libraries parallelized with
+// OpenMP can run independently on each node at once. New threads start
+// from OpenMP's global default rather than the creating thread's count, so
+// each team is sized explicitly: an even split of `total_threads`, capped
+// at the node's CPUs.
+class NodeWorkers {
+public:
+  explicit NodeWorkers(int nodes = numa_nodes(),
+                       int total_threads = omp_get_max_threads()) {
+    for (int node = 0; node < nodes; node++) {
+      threads.emplace_back([this, node, nodes, total_threads]() {
+        loop(node, nodes, total_threads);
+      });
+    }
+  }
+  NodeWorkers(NodeWorkers const &) = delete;
+  NodeWorkers &operator=(NodeWorkers const &) = delete;
+  ~NodeWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stop = true;
+    }
+    work_cv.notify_all();
+    for (auto &t : threads)
+      t.join();
+  }
+
+  int size() const { return threads.size(); }
+
+  // Runs fn(node) on every worker and waits for all of them.
+  void run(std::function<void(int)> const &fn) {
+    std::unique_lock<std::mutex> lock(mu);
+    job = &fn;
+    pending = threads.size();
+    generation++;
+    work_cv.notify_all();
+    done_cv.wait(lock, [&]() { return pending == 0; });
+    job = nullptr;
+    if (error) {
+      auto e = error;
+      error = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+
+private:
+  void loop(int node, int nodes, int total_threads) {
+    int node_cpus = omp_get_num_procs() / nodes;
+    if (nodes > 1 && numa_available() >= 0) {
+      numa_run_on_node(node);
+      struct bitmask *cpus = numa_allocate_cpumask();
+      if (numa_node_to_cpus(node, cpus) == 0)
+        node_cpus = numa_bitmask_weight(cpus);
+      numa_free_cpumask(cpus);
+    }
+    omp_set_num_threads(
+        std::max(1, std::min(node_cpus, total_threads / nodes)));
+
+    uint64_t seen = 0;
+    while (true) {
+      std::function<void(int)> const *fn;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        work_cv.wait(lock, [&]() { return stop || generation != seen; });
+        if (stop)
+          return;
+        seen = generation;
+        fn = job;
+      }
+      std::exception_ptr e;
+      try {
+        (*fn)(node);
+      } catch (...) {
+        e = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        if (e && !error)
+          error = e;
+        if (--pending == 0)
+          done_cv.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> threads;
+  std::mutex mu;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  std::function<void(int)> const *job = nullptr;
+  std::exception_ptr error;
+  uint64_t generation = 0;
+  int pending = 0;
+  bool stop = false;
+};
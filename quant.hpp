@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "pages.hpp"
+
+// Symmetric linear quantization of row-major f32 matrices to 8 bits:
+// q = round(x / scale), with scale = absmax / 127 (s8) or max / 255 (u8).
+// u8 has no zero point, so it is meant for non-negative activations;
+// negative values clamp to 0.
+enum class QuantScales { per_tensor, per_row };
+
+struct QuantizedMatrix {
+  int64_t rows = 0;
+  int64_t cols = 0;
+  bool is_unsigned = false;
+  // s8 or u8 values, depending on `is_unsigned`.
+  std::vector<uint8_t, AlignedAllocator<uint8_t>> data;
+  // One scale per row, or a single one for the whole tensor.
+  std::vector<float> scales;
+};
+
+static void quantize_matrix(float const *src, int64_t rows, int64_t cols,
+                            bool is_unsigned, QuantScales granularity,
+                            QuantizedMatrix &q) {
+  q.rows = rows;
+  q.cols = cols;
+  q.is_unsigned = is_unsigned;
+  q.data.resize(rows * cols);
+
+  std::vector<float> absmax(rows);
+#pragma omp parallel for
+  for (int64_t r = 0; r < rows; r++) {
+    float m = 0;
+    for (int64_t c = 0; c < cols; c++) {
+      m = std::max(m, std::fabs(src[r * cols + c]));
+    }
+    absmax[r] = m;
+  }
+  if (granularity == QuantScales::per_tensor) {
+    float m = 0;
+    for (float v : absmax)
+      m = std::max(m, v);
+    absmax.assign(1, m);
+  }
+
+  float qmax = is_unsigned ? 255.0f : 127.0f;
+  float qmin = is_unsigned ? 0.0f : -127.0f;
+  q.scales.resize(absmax.size());
+  for (size_t i = 0; i < absmax.size(); i++) {
+    q.scales[i] = absmax[i] > 0 ? absmax[i] / qmax : 1.0f;
+  }
+
+#pragma omp parallel for
+  for (int64_t r = 0; r < rows; r++) {
+    float inv = 1.0f / q.scales[q.scales.size() == 1 ? 0 : r];
+    uint8_t *dst = q.data.data() + r * cols;
+    for (int64_t c = 0; c < cols; c++) {
+      float v = std::clamp(std::nearbyint(src[r * cols + c] * inv), qmin, qmax);
+      dst[c] = is_unsigned ? (uint8_t)v : (uint8_t)(int8_t)v;
+    }
+  }
+}
+
+static float quant_scale(QuantizedMatrix const &q, int64_t row) {
+  return q.scales[q.scales.size() == 1 ? 0 : row];
+}
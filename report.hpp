@@ -0,0 +1,273 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/utsname.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+// Machine-readable copies of the result tables: CSV (one header line per
+// table) and/or JSON lines (one object per row). Every row carries the run
+// metadata so files from different hosts and builds can be concatenated.
+
+struct RunMetadata {
+  std::string tool;
+  std::string timestamp;
+  std::string host;
+  std::string kernel;
+  std::string cpu;
+  std::string compiler;
+  std::string build_flags;
+  std::string command;
+};
+
+static std::string cpu_model_name() {
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("model name", 0) == 0) {
+      auto colon = line.find(':');
+      if (colon != std::string::npos)
+        return line.substr(line.find_first_not_of(' ', colon + 1));
+    }
+  }
+  return "unknown";
+}
+
+// What the translation unit was compiled with, as far as the predefined
+// macros tell.
+static std::string build_flags() {
+  std::string flags;
+  auto add = [&](char const *flag) {
+    if (!flags.empty())
+      flags += ' ';
+    flags += flag;
+  };
+#if defined(__OPTIMIZE__)
+  add("optimize");
+#endif
+#if defined(_OPENMP)
+  add("openmp");
+#endif
+#if defined(__AVX2__)
+  add("avx2");
+#endif
+#if defined(__AVX512F__)
+  add("avx512f");
+#endif
+#if defined(__AVX512BF16__)
+  add("avx512bf16");
+#endif
+#if defined(__AMX_TILE__)
+  add("amx-tile");
+#endif
+#if defined(__AMX_BF16__)
+  add("amx-bf16");
+#endif
+#if defined(__AMX_INT8__)
+  add("amx-int8");
+#endif
+  return flags;
+}
+
+static RunMetadata collect_metadata(std::string const &tool, int argc,
+                                    char **argv) {
+  RunMetadata meta;
+  meta.tool = tool;
+
+  char stamp[32];
+  std::time_t now = std::time(nullptr);
+  std::tm utc;
+  gmtime_r(&now, &utc);
+  std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+  meta.timestamp = stamp;
+
+  char host[256] = {};
+  gethostname(host, sizeof(host) - 1);
+  meta.host = host;
+  utsname uts;
+  if (uname(&uts) == 0)
+    meta.kernel = std::string(uts.sysname) + " " + uts.release;
+  meta.cpu = cpu_model_name();
+#if defined(__clang__)
+  meta.compiler = "clang " __VERSION__;
+#elif defined(__GNUC__)
+  meta.compiler = "gcc " __VERSION__;
+#endif
+  meta.build_flags = build_flags();
+  for (int i = 0; i < argc; i++) {
+    if (i)
+      meta.command += ' ';
+    meta.command += argv[i];
+  }
+  return meta;
+}
+
+class ResultWriter {
+public:
+  explicit ResultWriter(RunMetadata meta) : meta(std::move(meta)) {}
+
+  // `path` "-" writes to stdout.
+  void open_csv(std::string const &path) { csv = open(path, csv_file); }
+  void open_json(std::string const &path) { json = open(path, json_file); }
+
+  // The pretty tables are skipped when a machine-readable stream owns
+  // stdout.
+  bool writes_stdout() const { return to_stdout; }
+
+  template <typename... Ts>
+  void write(std::string const &table, std::vector<std::string> const &headers,
+             Ts const &...values) {
+    if (!csv && !json)
+      return;
+    std::vector<Field> fields = {field(values)...};
+    if (csv)
+      write_csv(table, headers, fields);
+    if (json)
+      write_json(table, headers, fields);
+  }
+
+private:
+  struct Field {
+    std::string text;
+    bool numeric = false;
+    // Non-finite numbers; JSON has no literal for them.
+    bool null = false;
+  };
+
+  std::ostream *open(std::string const &path,
+                     std::unique_ptr<std::ofstream> &file) {
+    if (path == "-") {
+      to_stdout = true;
+      return &std::cout;
+    }
+    file = std::make_unique<std::ofstream>(path, std::ios::app);
+    if (!*file)
+      throw std::runtime_error("cannot open " + path);
+    return file.get();
+  }
+
+  // Shortest representation that round-trips.
+  template <typename T> static Field field(T const &v) {
+    if constexpr (std::is_arithmetic_v<T>) {
+      if constexpr (std::is_floating_point_v<T>) {
+        if (!std::isfinite(v))
+          return {std::isnan(v) ? "nan" : (v > 0 ? "inf" : "-inf"), false,
+                  true};
+      }
+      char buf[64];
+      auto res = std::to_chars(buf, buf + sizeof(buf), v);
+      return {std::string(buf, res.ptr), true};
+    } else {
+      return {std::string(v), false};
+    }
+  }
+
+  std::vector<std::string> meta_names() const {
+    return {"tool", "timestamp", "host",        "kernel",
+            "cpu",  "compiler",  "build_flags", "command"};
+  }
+  std::vector<std::string> meta_values() const {
+    return {meta.tool,     meta.timestamp,   meta.host,
+            meta.kernel,   meta.cpu,         meta.compiler,
+            meta.build_flags, meta.command};
+  }
+
+  static std::string csv_quote(std::string const &s) {
+    if (s.find_first_of(",\"\n") == std::string::npos)
+      return s;
+    std::string out = "\"";
+    for (char c : s) {
+      if (c == '"')
+        out += '"';
+      out += c;
+    }
+    return out + "\"";
+  }
+
+  static std::string json_quote(std::string const &s) {
+    std::string out = "\"";
+    for (char c : s) {
+      switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+      }
+    }
+    return out + "\"";
+  }
+
+  void write_csv(std::string const &table,
+                 std::vector<std::string> const &headers,
+                 std::vector<Field> const &fields) {
+    std::string header;
+    for (auto const &name : meta_names())
+      header += csv_quote(name) + ",";
+    header += "table";
+    for (auto const &name : headers)
+      header += "," + csv_quote(name);
+    if (header != csv_header) {
+      *csv << header << "\n";
+      csv_header = header;
+    }
+    for (auto const &v : meta_values())
+      *csv << csv_quote(v) << ",";
+    *csv << csv_quote(table);
+    for (auto const &f : fields)
+      *csv << "," << csv_quote(f.text);
+    *csv << std::endl;
+  }
+
+  void write_json(std::string const &table,
+                  std::vector<std::string> const &headers,
+                  std::vector<Field> const &fields) {
+    auto names = meta_names();
+    auto values = meta_values();
+    *json << "{";
+    for (size_t i = 0; i < names.size(); i++)
+      *json << json_quote(names[i]) << ":" << json_quote(values[i]) << ",";
+    *json << "\"table\":" << json_quote(table);
+    for (size_t i = 0; i < fields.size(); i++) {
+      *json << "," << json_quote(headers[i]) << ":";
+      if (fields[i].numeric)
+        *json << fields[i].text;
+      else if (fields[i].null)
+        *json << "null";
+      else
+        *json << json_quote(fields[i].text);
+    }
+    *json << "}" << std::endl;
+  }
+
+  RunMetadata meta;
+  std::unique_ptr<std::ofstream> csv_file, json_file;
+  std::ostream *csv = nullptr;
+  std::ostream *json = nullptr;
+  std::string csv_header;
+  bool to_stdout = false;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+// Counter-based generator: element i of stream `seed` is splitmix64's
+// finalizer applied to (key(seed) + i * golden). Any thread can produce any
+// range independently, so parallel fills are race-free and give the same
+// data regardless of thread count or schedule.
+
+static constexpr uint64_t SPLITMIX_GOLDEN = 0x9e3779b97f4a7c15ull;
+
+static inline uint64_t splitmix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t rng_key(uint64_t seed) {
+  return splitmix64(seed * SPLITMIX_GOLDEN + 1);
+}
+
+// Uniform float in [0, 1) from the top 24 bits.
+static inline float rng_uniform(uint64_t key, uint64_t i) {
+  return (splitmix64(key + i * SPLITMIX_GOLDEN) >> 40) * 0x1.0p-24f;
+}
+
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+// GCC 12's _mm512_srli_epi64 merges into an undefined vector and trips
+// -Wmaybe-uninitialized; the zero-masked form with every lane set is the
+// same shift.
+static inline __m512i srli_x8(__m512i z, unsigned n) {
+  return _mm512_maskz_srli_epi64(0xff, z, n);
+}
+
+static inline __m512i splitmix64_x8(__m512i z) {
+  z = _mm512_mullo_epi64(_mm512_xor_si512(z, srli_x8(z, 30)),
+                         _mm512_set1_epi64(0xbf58476d1ce4e5b9ull));
+  z = _mm512_mullo_epi64(_mm512_xor_si512(z, srli_x8(z, 27)),
+                         _mm512_set1_epi64(0x94d049bb133111ebull));
+  return _mm512_xor_si512(z, srli_x8(z, 31));
+}
+
+// 16 consecutive rng_uniform values starting at element i.
+static inline __m512 rng_uniform_x16(uint64_t key, uint64_t i) {
+  const __m512i lane = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m512i golden = _mm512_set1_epi64(SPLITMIX_GOLDEN);
+  __m512i c0 = _mm512_add_epi64(_mm512_set1_epi64(i), lane);
+  __m512i c1 = _mm512_add_epi64(c0, _mm512_set1_epi64(8));
+  __m512i k = _mm512_set1_epi64(key);
+  __m512i h0 = splitmix64_x8(_mm512_add_epi64(k, _mm512_mullo_epi64(c0, golden)));
+  __m512i h1 = splitmix64_x8(_mm512_add_epi64(k, _mm512_mullo_epi64(c1, golden)));
+  __m256 lo = _mm512_cvtepi64_ps(srli_x8(h0, 40));
+  __m256 hi = _mm512_cvtepi64_ps(srli_x8(h1, 40));
+  __m512 f = _mm512_insertf32x8(_mm512_castps256_ps512(lo), hi, 1);
+  return _mm512_mul_ps(f, _mm512_set1_ps(0x1.0p-24f));
+}
+#endif
+
+// Fills `data` with uniform floats in [0, 1) from stream `seed`. Pages are
+// first touched by the thread that writes them, so with a static schedule
+// each thread's block lands on its own NUMA node.
+inline void fill_uniform(float *data, size_t n, uint64_t seed) {
+  constexpr size_t block = 1 << 16;
+  uint64_t key = rng_key(seed);
+  int64_t blocks = (n + block - 1) / block;
+#pragma omp parallel for schedule(static)
+  for (int64_t b = 0; b < blocks; b++) {
+    size_t i = b * block;
+    size_t end = i + block < n ? i + block : n;
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    for (; i + 16 <= end; i += 16) {
+      _mm512_storeu_ps(data + i, rng_uniform_x16(key, i));
+    }
+#endif
+    for (; i < end; i++) {
+      data[i] = rng_uniform(key, i);
+    }
+  }
+}
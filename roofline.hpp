@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <immintrin.h>
+#include <map>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+#include "cpuid.hpp"
+#include "pages.hpp"
+
+// Roofline model from measured rather than datasheet peaks. Compute peaks
+// come from register-only loops on every OpenMP thread and are kept per
+// thread, so rows run at fewer threads are compared against the matching
+// fraction of the machine. The memory peak is a parallel read of a buffer
+// far larger than the LLC, measured separately at every thread count a row
+// runs at: a few threads cannot saturate the memory controllers, so the
+// whole-machine figure would understate their memory utilization.
+
+struct Roofline {
+  // Per-thread compute peaks.
+  double f32_gflops = 0;
+  double bf16_gflops = 0;
+  double int8_gops = 0;
+  // Read bandwidth at the calibration thread count.
+  double mem_gbs = 0;
+  // Read bandwidth by thread count, filled in as rows need it.
+  std::map<int32_t, double> mem_gbs_by_threads;
+};
+
+template <typename Fn> static double seconds(Fn &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+// 12 independent FMA chains cover the FMA latency on two ports.
+__attribute__((target("avx512f"))) static float fma_loop_avx512(int64_t n) {
+  __m512 acc[12];
+  for (int j = 0; j < 12; j++)
+    acc[j] = _mm512_set1_ps(j);
+  __m512 a = _mm512_set1_ps(0.999999f), b = _mm512_set1_ps(1e-6f);
+  for (int64_t i = 0; i < n; i++) {
+    for (int j = 0; j < 12; j++)
+      acc[j] = _mm512_fmadd_ps(acc[j], a, b);
+  }
+  for (int j = 1; j < 12; j++)
+    acc[0] = _mm512_add_ps(acc[0], acc[j]);
+  float out[16];
+  _mm512_storeu_ps(out, acc[0]);
+  return out[0];
+}
+
+__attribute__((target("avx2,fma"))) static float fma_loop_avx2(int64_t n) {
+  __m256 acc[12];
+  for (int j = 0; j < 12; j++)
+    acc[j] = _mm256_set1_ps(j);
+  __m256 a = _mm256_set1_ps(0.999999f), b = _mm256_set1_ps(1e-6f);
+  for (int64_t i = 0; i < n; i++) {
+    for (int j = 0; j < 12; j++)
+      acc[j] = _mm256_fmadd_ps(acc[j], a, b);
+  }
+  float out[8];
+  for (int j = 1; j < 12; j++)
+    acc[0] = _mm256_add_ps(acc[0], acc[j]);
+  _mm256_storeu_ps(out, acc[0]);
+  return out[0];
+}
+
+static double peak_f32_gflops_per_thread() {
+  __builtin_cpu_init();
+  bool avx512 = __builtin_cpu_supports("avx512f");
+  int lanes = avx512 ? 16 : 8;
+  constexpr int64_t n = 20'000'000;
+  volatile float sink = 0;
+  int threads = omp_get_max_threads();
+  double s = seconds([&]() {
+#pragma omp parallel
+    {
+      float r = avx512 ? fma_loop_avx512(n) : fma_loop_avx2(n);
+      if (r == 42)
+        sink = r;
+    }
+  });
+  return (double)n * 12 * lanes * 2 / s / 1e9 / threads;
+}
+
+#if defined(__AMX_BF16__) && defined(__AMX_INT8__)
+// Four accumulators fed from tiles that never leave the registers. Each
+// tdpbf16ps is 16 x 16 x 32 multiply-adds, each tdpbssd 16 x 16 x 64.
+static double amx_loop(bool int8, int64_t n) {
+  struct alignas(64) {
+    uint8_t palette_id = 1;
+    uint8_t start_row = 0;
+    uint8_t reserved[14] = {};
+    uint16_t colsb[16] = {};
+    uint8_t rows[16] = {};
+  } cfg;
+  for (int t = 0; t < 8; t++) {
+    cfg.colsb[t] = 64;
+    cfg.rows[t] = 16;
+  }
+  _tile_loadconfig(&cfg);
+  // Zeroed operands; the data does not change the TMUL's throughput.
+  _tile_zero(0);
+  _tile_zero(1);
+  _tile_zero(2);
+  _tile_zero(3);
+  _tile_zero(4);
+  _tile_zero(5);
+  _tile_zero(6);
+  _tile_zero(7);
+  double s = seconds([&]() {
+    if (int8) {
+      for (int64_t i = 0; i < n; i++) {
+        _tile_dpbssd(0, 4, 6);
+        _tile_dpbssd(1, 4, 7);
+        _tile_dpbssd(2, 5, 6);
+        _tile_dpbssd(3, 5, 7);
+      }
+    } else {
+      for (int64_t i = 0; i < n; i++) {
+        _tile_dpbf16ps(0, 4, 6);
+        _tile_dpbf16ps(1, 4, 7);
+        _tile_dpbf16ps(2, 5, 6);
+        _tile_dpbf16ps(3, 5, 7);
+      }
+    }
+  });
+  _tile_release();
+  return s;
+}
+#endif
+
+// 0 without AMX.
+static double peak_amx_gops_per_thread(bool int8) {
+#if defined(__AMX_BF16__) && defined(__AMX_INT8__)
+  if (!is_amxbf16_supported() || !request_amx_permission())
+    return 0;
+  constexpr int64_t n = 1'000'000;
+  double ops_per_iter = 4.0 * 16 * 16 * (int8 ? 64 : 32) * 2;
+  double total = 0;
+#pragma omp parallel reduction(+ : total)
+  { total += ops_per_iter * n / amx_loop(int8, n) / 1e9; }
+  return total / omp_get_max_threads();
+#else
+  (void)int8;
+  return 0;
+#endif
+}
+
+// Best of three parallel passes summing a `bytes` buffer.
+static double peak_read_gbs(size_t bytes = size_t(1) << 30) {
+  size_t n = bytes / sizeof(uint64_t);
+  std::vector<uint64_t, AlignedAllocator<uint64_t>> buf(n);
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < n; i++)
+    buf[i] = i;
+  volatile uint64_t sink = 0;
+  double best = 0;
+  for (int pass = 0; pass < 3; pass++) {
+    uint64_t sum = 0;
+    double s = seconds([&]() {
+#pragma omp parallel for schedule(static) reduction(+ : sum)
+      for (size_t i = 0; i < n; i++)
+        sum += buf[i];
+    });
+    sink = sum;
+    best = std::max(best, bytes / s / 1e9);
+  }
+  (void)sink;
+  return best;
+}
+
+static Roofline calibrate_roofline() {
+  Roofline r;
+  r.f32_gflops = peak_f32_gflops_per_thread();
+  r.bf16_gflops = peak_amx_gops_per_thread(false);
+  r.int8_gops = peak_amx_gops_per_thread(true);
+  r.mem_gbs = peak_read_gbs();
+  r.mem_gbs_by_threads[omp_get_max_threads()] = r.mem_gbs;
+  return r;
+}
+
+// Read bandwidth of `threads` threads, measured on first use.
+static double roofline_read_gbs(Roofline &r, int32_t threads) {
+  auto it = r.mem_gbs_by_threads.find(threads);
+  if (it != r.mem_gbs_by_threads.end())
+    return it->second;
+  int32_t previous = omp_get_max_threads();
+  omp_set_num_threads(threads);
+  double gbs = peak_read_gbs();
+  omp_set_num_threads(previous);
+  r.mem_gbs_by_threads[threads] = gbs;
+  return gbs;
+}
+
+// Where one measurement sits under the roof of its precision.
+struct RooflinePoint {
+  // FLOP per byte of compulsory traffic.
+  double intensity = 0;
+  double bandwidth_gbs = 0;
+  double pct_compute = 0;
+  double pct_memory = 0;
+  bool compute_bound = false;
+};
+
+static RooflinePoint roofline_point(double flop, double bytes, double ns,
+                                    double peak_gflops, double peak_gbs) {
+  RooflinePoint p;
+  p.intensity = flop / bytes;
+  p.bandwidth_gbs = bytes / ns;
+  p.pct_compute = 100 * (flop / ns) / peak_gflops;
+  p.pct_memory = 100 * p.bandwidth_gbs / peak_gbs;
+  // Right of the ridge point the roof is compute.
+  p.compute_bound = p.intensity >= peak_gflops / peak_gbs;
+  return p;
+}
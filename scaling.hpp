@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Strong-scaling analysis of one shape measured at several thread counts.
+// Speedup and efficiency are relative to the smallest thread count
+// measured, so a sweep that starts at 2 threads reports efficiency against
+// 2 threads per unit of work rather than pretending it ran serially.
+
+struct ScalingRow {
+  int32_t threads = 0;
+  double ns = 0;
+  double speedup = 0;
+  double efficiency = 0;
+};
+
+// 1, 2, 4, ... up to `max_threads`, which is always included.
+static std::vector<uint64_t> scaling_thread_counts(int32_t max_threads) {
+  std::vector<uint64_t> counts;
+  for (int32_t t = 1; t < max_threads; t *= 2)
+    counts.push_back(t);
+  counts.push_back(max_threads);
+  return counts;
+}
+
+inline std::vector<ScalingRow> scaling_rows(std::vector<ScalingRow> rows) {
+  std::sort(rows.begin(), rows.end(),
+            [](auto const &a, auto const &b) { return a.threads < b.threads; });
+  if (rows.empty())
+    return rows;
+  auto const &base = rows.front();
+  for (auto &r : rows) {
+    r.speedup = base.ns / r.ns;
+    r.efficiency = r.speedup * base.threads / r.threads;
+  }
+  return rows;
+}
+
+// The thread count after which adding threads stops paying: the first step
+// to the next measured count that gains less than `min_gain` of the ideal
+// (linear) extra speedup. The largest count if scaling never flattens.
+inline int32_t scaling_knee(std::vector<ScalingRow> const &rows,
+                            double min_gain = 0.5) {
+  for (size_t i = 0; i + 1 < rows.size(); i++) {
+    double ideal = rows[i].speedup * rows[i + 1].threads / rows[i].threads;
+    double gained = rows[i + 1].speedup - rows[i].speedup;
+    if (gained < min_gain * (ideal - rows[i].speedup))
+      return rows[i].threads;
+  }
+  return rows.empty() ? 0 : rows.back().threads;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <string>
+#include <vector>
+
+#include "pages.hpp"
+
+// FP32 register-blocked GEMM baselines: C (M x N) = A (M x K) * B (K x N),
+// all row-major. A is packed into MR-row panels (k-major) and B into
+// NR-column panels, both zero-padded, so the micro-kernel always computes a
+// full MR x NR block of C in registers: per k it broadcasts MR values of A
+// against two vectors of B with 2 * MR FMAs. The ISA is chosen at runtime;
+// each micro-kernel is compiled for its own target.
+
+enum class SimdIsa { avx2, avx512 };
+
+static bool simd_isa_supported(SimdIsa isa) {
+  __builtin_cpu_init();
+  switch (isa) {
+  case SimdIsa::avx2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case SimdIsa::avx512:
+    return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+}
+
+static std::string simd_isa_name(SimdIsa isa) {
+  return isa == SimdIsa::avx512 ? "AVX-512" : "AVX2";
+}
+
+// 6 x 32 block: 12 zmm accumulators.
+__attribute__((target("avx512f"))) static void
+simd_kernel_avx512(float const *ap, float const *bp, int64_t k, float *c,
+                   int64_t ldc) {
+  __m512 acc[6][2];
+  for (int i = 0; i < 6; i++) {
+    acc[i][0] = _mm512_setzero_ps();
+    acc[i][1] = _mm512_setzero_ps();
+  }
+  for (int64_t p = 0; p < k; p++) {
+    __m512 b0 = _mm512_load_ps(bp + p * 32);
+    __m512 b1 = _mm512_load_ps(bp + p * 32 + 16);
+    for (int i = 0; i < 6; i++) {
+      __m512 a = _mm512_set1_ps(ap[p * 6 + i]);
+      acc[i][0] = _mm512_fmadd_ps(a, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(a, b1, acc[i][1]);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    _mm512_storeu_ps(c + i * ldc, acc[i][0]);
+    _mm512_storeu_ps(c + i * ldc + 16, acc[i][1]);
+  }
+}
+
+// 6 x 16 block: 12 ymm accumulators.
+__attribute__((target("avx2,fma"))) static void
+simd_kernel_avx2(float const *ap, float const *bp, int64_t k, float *c,
+                 int64_t ldc) {
+  __m256 acc[6][2];
+  for (int i = 0; i < 6; i++) {
+    acc[i][0] = _mm256_setzero_ps();
+    acc[i][1] = _mm256_setzero_ps();
+  }
+  for (int64_t p = 0; p < k; p++) {
+    __m256 b0 = _mm256_load_ps(bp + p * 16);
+    __m256 b1 = _mm256_load_ps(bp + p * 16 + 8);
+    for (int i = 0; i < 6; i++) {
+      __m256 a = _mm256_broadcast_ss(ap + p * 6 + i);
+      acc[i][0] = _mm256_fmadd_ps(a, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(a, b1, acc[i][1]);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    _mm256_storeu_ps(c + i * ldc, acc[i][0]);
+    _mm256_storeu_ps(c + i * ldc + 8, acc[i][1]);
+  }
+}
+
+class SimdF32Gemm {
+public:
+  static constexpr int64_t MR = 6;
+
+  SimdF32Gemm(int64_t m, int64_t n, int64_t k, SimdIsa isa)
+      : m(m), n(n), k(k), isa(isa), nr(isa == SimdIsa::avx512 ? 32 : 16),
+        mp((m + MR - 1) / MR), np((n + nr - 1) / nr),
+        a_panels(mp * MR * k), b_panels(np * nr * k) {}
+
+  SimdIsa engine_isa() const { return isa; }
+
+  void pack_a(float const *a) {
+#pragma omp parallel for
+    for (int64_t pi = 0; pi < mp; pi++) {
+      float *panel = a_panels.data() + pi * MR * k;
+      for (int64_t p = 0; p < k; p++) {
+        for (int64_t i = 0; i < MR; i++) {
+          int64_t row = pi * MR + i;
+          panel[p * MR + i] = row < m ? a[row * k + p] : 0;
+        }
+      }
+    }
+  }
+
+  // `b` is K x N row-major, or N x K (inner product weights) if
+  // `transposed`.
+  void pack_b(float const *b, bool transposed = false) {
+#pragma omp parallel for
+    for (int64_t pj = 0; pj < np; pj++) {
+      float *panel = b_panels.data() + pj * nr * k;
+      for (int64_t p = 0; p < k; p++) {
+        for (int64_t j = 0; j < nr; j++) {
+          int64_t col = pj * nr + j;
+          float v = 0;
+          if (col < n)
+            v = transposed ? b[col * k + p] : b[p * n + col];
+          panel[p * nr + j] = v;
+        }
+      }
+    }
+  }
+
+  // Overwrites `c` (M x N row-major) with A * B. Consecutive iterations
+  // share a B panel, which stays in L2 while the A panels stream past it.
+  void run(float *c) {
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int64_t pj = 0; pj < np; pj++) {
+      for (int64_t pi = 0; pi < mp; pi++) {
+        float const *ap = a_panels.data() + pi * MR * k;
+        float const *bp = b_panels.data() + pj * nr * k;
+        int64_t rows = std::min(MR, m - pi * MR);
+        int64_t cols = std::min(nr, n - pj * nr);
+        float *out = c + pi * MR * n + pj * nr;
+        if (rows == MR && cols == nr) {
+          kernel(ap, bp, out, n);
+          continue;
+        }
+        alignas(64) float tile[MR * 32];
+        kernel(ap, bp, tile, nr);
+        for (int64_t i = 0; i < rows; i++) {
+          std::memcpy(out + i * n, tile + i * nr, cols * sizeof(float));
+        }
+      }
+    }
+  }
+
+private:
+  void kernel(float const *ap, float const *bp, float *c, int64_t ldc) {
+    if (isa == SimdIsa::avx512)
+      simd_kernel_avx512(ap, bp, k, c, ldc);
+    else
+      simd_kernel_avx2(ap, bp, k, c, ldc);
+  }
+
+  int64_t m, n, k;
+  SimdIsa isa;
+  int64_t nr;
+  int64_t mp, np;
+  std::vector<float, AlignedAllocator<float>> a_panels;
+  std::vector<float, AlignedAllocator<float>> b_panels;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define ITERATIONS 10
+
+// Summary of per-iteration latencies, all in nanoseconds.
+struct LatencyStats {
+  std::vector<int64_t> samples;
+  double min = 0;
+  double median = 0;
+  double p90 = 0;
+  double p99 = 0;
+  double max = 0;
+  double mean = 0;
+  double stddev = 0;
+};
+
+// Linearly interpolated percentile `p` in [0, 1] of an ascending vector.
+static double percentile(std::vector<int64_t> const &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  double pos = p * (sorted.size() - 1);
+  size_t lo = (size_t)pos;
+  size_t hi = std::min(lo + 1, sorted.size() - 1);
+  return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+static LatencyStats summarize(std::vector<int64_t> samples) {
+  LatencyStats st;
+  st.samples = std::move(samples);
+  if (st.samples.empty())
+    return st;
+
+  std::vector<int64_t> sorted = st.samples;
+  std::sort(sorted.begin(), sorted.end());
+  st.min = sorted.front();
+  st.max = sorted.back();
+  st.median = percentile(sorted, 0.5);
+  st.p90 = percentile(sorted, 0.9);
+  st.p99 = percentile(sorted, 0.99);
+
+  double sum = 0;
+  for (auto s : sorted)
+    sum += s;
+  st.mean = sum / sorted.size();
+  double var = 0;
+  for (auto s : sorted)
+    var += (s - st.mean) * (s - st.mean);
+  st.stddev = sorted.size() > 1 ? std::sqrt(var / (sorted.size() - 1)) : 0;
+  return st;
+}
+
+// Two-sided 95% Student t quantile for `df` degrees of freedom.
+static double t95(int64_t df) {
+  static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+                                 2.365,  2.306, 2.262, 2.228, 2.201, 2.179,
+                                 2.160,  2.145, 2.131, 2.120, 2.110, 2.101,
+                                 2.093,  2.086, 2.080, 2.074, 2.069, 2.064,
+                                 2.060,  2.056, 2.052, 2.048, 2.045, 2.042};
+  if (df < 1)
+    return INFINITY;
+  if (df <= 30)
+    return table[df - 1];
+  return 1.96;
+}
+
+// How many samples to take. With `target_rel_ci` set, sampling continues past
+// `iterations` until the 95% confidence interval of the mean is within that
+// fraction of the mean, or until `budget_s` or `max_iterations` is reached.
+// The budget also cuts `iterations` short once BUDGET_MIN_SAMPLES are in, so
+// shapes that take seconds per sample get only a few.
+static constexpr int32_t BUDGET_MIN_SAMPLES = 3;
+
+struct SamplingPolicy {
+  int32_t iterations = ITERATIONS;
+  double target_rel_ci = 0;
+  double budget_s = 10;
+  int64_t max_iterations = 1000000;
+};
+
+// Relative half-width of the 95% CI of the mean of `samples`.
+inline double relative_ci(std::vector<int64_t> const &samples) {
+  auto st = summarize(samples);
+  if (samples.size() < 2 || st.mean == 0)
+    return INFINITY;
+  return t95(samples.size() - 1) * st.stddev / std::sqrt(samples.size()) /
+         st.mean;
+}
+
+// Calls `once()` (which returns one latency sample in ns) as often as
+// `policy` asks for and returns the samples.
+template <typename Fn>
+static std::vector<int64_t> collect_samples(SamplingPolicy const &policy,
+                                            Fn &&once) {
+  std::vector<int64_t> samples;
+  samples.reserve(policy.iterations);
+  double n = 0, mean = 0, m2 = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (true) {
+    int64_t s = once();
+    samples.push_back(s);
+
+    // Welford's running variance keeps the stopping test O(1).
+    n += 1;
+    double delta = s - mean;
+    mean += delta / n;
+    m2 += delta * (s - mean);
+
+    bool sampling_ci = policy.target_rel_ci > 0;
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (sampling_ci && samples.size() >= BUDGET_MIN_SAMPLES &&
+        elapsed >= policy.budget_s)
+      break;
+    if ((int64_t)samples.size() < policy.iterations)
+      continue;
+    if (!sampling_ci || (int64_t)samples.size() >= policy.max_iterations)
+      break;
+    if (n > 1 && mean > 0) {
+      double ci = t95(n - 1) * std::sqrt(m2 / (n - 1)) / std::sqrt(n) / mean;
+      if (ci <= policy.target_rel_ci)
+        break;
+    }
+  }
+  return samples;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <immintrin.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+#include "pages.hpp"
+
+// STREAM-style bandwidth kernels over three double arrays. Every kernel
+// splits the arrays into one contiguous 64-byte aligned chunk per OpenMP
+// thread, the same split the initialization uses, so with first-touch
+// placement each thread streams memory on its own node.
+//
+// Traffic is counted the STREAM way: bytes the kernel names, not the
+// write-allocate reads the caches add for ordinary stores. The write-only
+// kernel uses non-temporal stores, which skip that read.
+
+enum class StreamKernel { copy, scale, add, triad, read, write_nt };
+
+static constexpr StreamKernel STREAM_KERNELS[] = {
+    StreamKernel::copy, StreamKernel::scale, StreamKernel::add,
+    StreamKernel::triad, StreamKernel::read, StreamKernel::write_nt};
+
+static std::string stream_kernel_name(StreamKernel k) {
+  switch (k) {
+  case StreamKernel::copy:
+    return "copy";
+  case StreamKernel::scale:
+    return "scale";
+  case StreamKernel::add:
+    return "add";
+  case StreamKernel::triad:
+    return "triad";
+  case StreamKernel::read:
+    return "read";
+  case StreamKernel::write_nt:
+    return "write (NT)";
+  }
+  return "?";
+}
+
+// Bytes moved per element.
+static size_t stream_kernel_bytes(StreamKernel k) {
+  switch (k) {
+  case StreamKernel::copy:
+  case StreamKernel::scale:
+    return 2 * sizeof(double);
+  case StreamKernel::add:
+  case StreamKernel::triad:
+    return 3 * sizeof(double);
+  default:
+    return sizeof(double);
+  }
+}
+
+using dvec = std::vector<double, AlignedAllocator<double>>;
+
+struct StreamArrays {
+  dvec a, b, c;
+
+  explicit StreamArrays(size_t n) : a(n), b(n), c(n) {}
+  size_t size() const { return a.size(); }
+};
+
+// [begin, end) of thread `t` of `threads`, in whole cache lines.
+static std::pair<size_t, size_t> stream_chunk(size_t n, int t, int threads) {
+  constexpr size_t line = 64 / sizeof(double);
+  size_t lines = (n + line - 1) / line;
+  size_t begin = std::min(n, lines * t / threads * line);
+  size_t end = std::min(n, lines * (t + 1) / threads * line);
+  return {begin, end};
+}
+
+// Writes the initial values; the first touch places the pages.
+static void stream_init(StreamArrays &s) {
+  size_t n = s.size();
+  double *a = s.a.data(), *b = s.b.data(), *c = s.c.data();
+#pragma omp parallel
+  {
+    auto [begin, end] =
+        stream_chunk(n, omp_get_thread_num(), omp_get_num_threads());
+    for (size_t i = begin; i < end; i++) {
+      a[i] = 1.0;
+      b[i] = 2.0;
+      c[i] = 0.0;
+    }
+  }
+}
+
+// Independent accumulators, so the sum is limited by loads rather than by
+// the latency of a single dependent add chain.
+static double stream_read(double const *a, size_t begin, size_t end) {
+  size_t i = begin;
+  double sum = 0;
+#if defined(__AVX512F__)
+  __m512d acc[4] = {_mm512_setzero_pd(), _mm512_setzero_pd(),
+                    _mm512_setzero_pd(), _mm512_setzero_pd()};
+  for (; i + 32 <= end; i += 32)
+    for (int j = 0; j < 4; j++)
+      acc[j] = _mm512_add_pd(acc[j], _mm512_load_pd(a + i + 8 * j));
+  alignas(64) double lanes[8];
+  _mm512_store_pd(lanes, _mm512_add_pd(_mm512_add_pd(acc[0], acc[1]),
+                                       _mm512_add_pd(acc[2], acc[3])));
+  for (double l : lanes)
+    sum += l;
+#else
+  double acc[4] = {};
+  for (; i + 4 <= end; i += 4)
+    for (int j = 0; j < 4; j++)
+      acc[j] += a[i + j];
+  sum = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+  for (; i < end; i++)
+    sum += a[i];
+  return sum;
+}
+
+static void stream_write_nt(double *a, size_t begin, size_t end, double v) {
+  size_t i = begin;
+#if defined(__AVX512F__)
+  __m512d x = _mm512_set1_pd(v);
+  for (; i + 8 <= end; i += 8)
+    _mm512_stream_pd(a + i, x);
+#else
+  __m128d x = _mm_set1_pd(v);
+  for (; i + 2 <= end; i += 2)
+    _mm_stream_pd(a + i, x);
+#endif
+  for (; i < end; i++)
+    a[i] = v;
+  _mm_sfence();
+}
+
+// One pass of `k` on the current OpenMP team; returns the elapsed ns.
+static int64_t stream_run(StreamKernel k, StreamArrays &s) {
+  size_t n = s.size();
+  double *a = s.a.data(), *b = s.b.data(), *c = s.c.data();
+  const double scalar = 3.0;
+  double total = 0;
+  auto start = std::chrono::steady_clock::now();
+#pragma omp parallel reduction(+ : total)
+  {
+    auto [begin, end] =
+        stream_chunk(n, omp_get_thread_num(), omp_get_num_threads());
+    switch (k) {
+    case StreamKernel::copy:
+      for (size_t i = begin; i < end; i++)
+        c[i] = a[i];
+      break;
+    case StreamKernel::scale:
+      for (size_t i = begin; i < end; i++)
+        b[i] = scalar * c[i];
+      break;
+    case StreamKernel::add:
+      for (size_t i = begin; i < end; i++)
+        c[i] = a[i] + b[i];
+      break;
+    case StreamKernel::triad:
+      for (size_t i = begin; i < end; i++)
+        a[i] = b[i] + scalar * c[i];
+      break;
+    case StreamKernel::read:
+      total += stream_read(a, begin, end);
+      break;
+    case StreamKernel::write_nt:
+      stream_write_nt(c, begin, end, scalar);
+      break;
+    }
+  }
+  auto stop = std::chrono::steady_clock::now();
+  // Keeps the read kernel from being optimized away.
+  volatile double sink = total;
+  (void)sink;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+      .count();
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Benchmark sweeps described by ranges instead of hard-coded vectors, e.g.
+//   --n1 1000:100000:x10 --n2 1000000,10000000 --m 128:3072:x2 --dtype bf16
+// or the same keys in a sweep file ("n1 = 1000:100000:x10", # comments).
+
+// One count. With `bytes`, a binary K/M/G suffix (optionally followed by
+// "iB" or "B") scales it: "48K" and "48KiB" are both 49152.
+static uint64_t parse_count(std::string const &text, bool bytes = false) {
+  size_t pos = 0;
+  uint64_t v = std::stoull(text, &pos);
+  std::string unit = text.substr(pos);
+  if (unit.empty())
+    return v;
+  if (bytes) {
+    for (auto suffix : {"iB", "B"}) {
+      auto len = std::string(suffix).size();
+      if (unit.size() > len && unit.ends_with(suffix)) {
+        unit.resize(unit.size() - len);
+        break;
+      }
+    }
+    if (unit == "K" || unit == "k")
+      return v << 10;
+    if (unit == "M")
+      return v << 20;
+    if (unit == "G")
+      return v << 30;
+  }
+  throw std::invalid_argument("not a count: " + text);
+}
+
+// "v", "a,b,c", "lo:hi:xF" (geometric) or "lo:hi:S" / "lo:hi:+S" (linear),
+// all inclusive of `hi` when it is hit exactly. `bytes` allows size
+// suffixes on the values and linear steps, as in "4K:1G:x2".
+static std::vector<uint64_t> parse_range(std::string const &spec,
+                                         bool bytes = false) {
+  std::vector<uint64_t> values;
+  if (spec.find(',') != std::string::npos) {
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      auto sub = parse_range(item, bytes);
+      values.insert(values.end(), sub.begin(), sub.end());
+    }
+    return values;
+  }
+  auto first = spec.find(':');
+  if (first == std::string::npos)
+    return {parse_count(spec, bytes)};
+  auto second = spec.find(':', first + 1);
+  if (second == std::string::npos)
+    throw std::invalid_argument("range needs lo:hi:step: " + spec);
+  uint64_t lo = parse_count(spec.substr(0, first), bytes);
+  uint64_t hi = parse_count(spec.substr(first + 1, second - first - 1), bytes);
+  std::string step = spec.substr(second + 1);
+  if (step.empty())
+    throw std::invalid_argument("empty step in range: " + spec);
+  if (step[0] == 'x' || step[0] == '*') {
+    double factor = std::stod(step.substr(1));
+    if (factor <= 1 || lo == 0)
+      throw std::invalid_argument("geometric range needs lo > 0, x > 1: " +
+                                  spec);
+    for (double v = lo; v <= hi * (1 + 1e-9); v *= factor)
+      values.push_back(std::llround(v));
+  } else {
+    uint64_t inc = parse_count(step[0] == '+' ? step.substr(1) : step, bytes);
+    if (inc == 0)
+      throw std::invalid_argument("zero step in range: " + spec);
+    for (uint64_t v = lo; v <= hi; v += inc)
+      values.push_back(v);
+  }
+  return values;
+}
+
+static std::vector<std::string> parse_list(std::string const &spec) {
+  std::vector<std::string> items;
+  std::stringstream ss(spec);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty())
+      items.push_back(item);
+  return items;
+}
+
+struct SweepPoint {
+  std::string mode;
+  std::string dtype;
+  // 0: the OpenMP default.
+  int32_t threads = 0;
+  uint64_t n1 = 0, n2 = 0, m = 0;
+
+  // Stable name used by --filter and the resume log.
+  std::string id() const {
+    return mode + "/" + dtype + "/t" + std::to_string(threads) + "/" +
+           std::to_string(n1) + "x" + std::to_string(n2) + "x" +
+           std::to_string(m);
+  }
+};
+
+struct SweepSpec {
+  std::vector<std::string> modes = {"ip"};
+  std::vector<std::string> dtypes = {"bf16"};
+  std::vector<uint64_t> threads = {0};
+  std::vector<uint64_t> n1s = {1000, 10000, 100000};
+  std::vector<uint64_t> n2s = {1000000, 10000000};
+  std::vector<uint64_t> ms = {128, 200, 1536, 3072};
+  // When set, shapes are size x size x size instead of n1 x n2 x m.
+  std::vector<uint64_t> sizes;
+
+  // Sets `key` from its textual value; the keys match the CLI options.
+  void set(std::string const &key, std::string const &value) {
+    if (key == "mode")
+      modes = parse_list(value);
+    else if (key == "dtype")
+      dtypes = parse_list(value);
+    else if (key == "threads")
+      threads = parse_range(value);
+    else if (key == "n1")
+      n1s = parse_range(value);
+    else if (key == "n2")
+      n2s = parse_range(value);
+    else if (key == "m")
+      ms = parse_range(value);
+    else if (key == "size")
+      sizes = parse_range(value);
+    else
+      throw std::invalid_argument("unknown sweep key: " + key);
+  }
+
+  void load(std::string const &path) {
+    std::ifstream in(path);
+    if (!in)
+      throw std::runtime_error("cannot open sweep file " + path);
+    std::string line;
+    int lineno = 0;
+    auto trim = [](std::string s) {
+      s.erase(0, s.find_first_not_of(" \t"));
+      s.erase(s.find_last_not_of(" \t\r") + 1);
+      return s;
+    };
+    while (std::getline(in, line)) {
+      lineno++;
+      line = trim(line.substr(0, line.find('#')));
+      if (line.empty())
+        continue;
+      auto eq = line.find('=');
+      if (eq == std::string::npos)
+        throw std::invalid_argument(path + ":" + std::to_string(lineno) +
+                                    ": expected key = value");
+      set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+    }
+  }
+
+  // Cartesian product. N1 varies fastest so packed weights are reused
+  // across batch sizes.
+  std::vector<SweepPoint> expand() const {
+    std::vector<SweepPoint> points;
+    for (auto const &mode : modes)
+      for (auto const &dtype : dtypes)
+        for (uint64_t t : threads) {
+          SweepPoint p{mode, dtype, (int32_t)t};
+          if (!sizes.empty()) {
+            for (uint64_t s : sizes) {
+              p.n1 = p.n2 = p.m = s;
+              points.push_back(p);
+            }
+            continue;
+          }
+          for (uint64_t n2 : n2s)
+            for (uint64_t m : ms)
+              for (uint64_t n1 : n1s) {
+                p.n1 = n1, p.n2 = n2, p.m = m;
+                points.push_back(p);
+              }
+        }
+    return points;
+  }
+};
+
+// Which points of a sweep to run: an optional regex on SweepPoint::id()
+// and a log of completed ids, appended after each point, that a rerun with
+// the same log skips.
+class SweepControl {
+public:
+  SweepControl(std::string const &filter, std::string const &resume_path) {
+    if (!filter.empty())
+      pattern = std::regex(filter);
+    if (resume_path.empty())
+      return;
+    std::ifstream in(resume_path);
+    std::string line;
+    while (std::getline(in, line))
+      if (!line.empty())
+        completed.insert(line);
+    log.open(resume_path, std::ios::app);
+    if (!log)
+      throw std::runtime_error("cannot open resume log " + resume_path);
+  }
+
+  bool wanted(SweepPoint const &p) const {
+    if (pattern && !std::regex_search(p.id(), *pattern))
+      return false;
+    return !completed.count(p.id());
+  }
+
+  void done(SweepPoint const &p) {
+    completed.insert(p.id());
+    if (log.is_open())
+      log << p.id() << std::endl;
+  }
+
+  size_t completed_count() const { return completed.size(); }
+
+private:
+  std::optional<std::regex> pattern;
+  std::set<std::string> completed;
+  std::ofstream log;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Sampled correctness checks: a f64 reference for C = A * B on a grid of
+// rows x columns spread evenly over the output (first and last included),
+// so the cost stays bounded for the largest shapes.
+
+// `b` is K x N row-major, or N x K (inner product weights) if `transposed`.
+static double reference_dot(int64_t n, int64_t k, float const *a,
+                            float const *b, bool transposed, int64_t row,
+                            int64_t col) {
+  double acc = 0;
+  float const *ar = a + row * k;
+  if (transposed) {
+    float const *br = b + col * k;
+    for (int64_t p = 0; p < k; p++)
+      acc += (double)ar[p] * br[p];
+  } else {
+    for (int64_t p = 0; p < k; p++)
+      acc += (double)ar[p] * b[p * n + col];
+  }
+  return acc;
+}
+
+struct VerifySample {
+  std::vector<int64_t> rows;
+  std::vector<int64_t> cols;
+  // rows.size() x cols.size(), row-major.
+  std::vector<double> ref;
+};
+
+static std::vector<int64_t> spread(int64_t extent, int64_t count) {
+  count = std::min(count, extent);
+  std::vector<int64_t> idx(count);
+  for (int64_t i = 0; i < count; i++)
+    idx[i] = count == 1 ? 0 : i * (extent - 1) / (count - 1);
+  return idx;
+}
+
+static VerifySample reference_sample(int64_t m, int64_t n, int64_t k,
+                                     float const *a, float const *b,
+                                     bool transposed, int64_t max_rows = 32,
+                                     int64_t max_cols = 256) {
+  VerifySample s;
+  s.rows = spread(m, max_rows);
+  s.cols = spread(n, max_cols);
+  s.ref.resize(s.rows.size() * s.cols.size());
+  int64_t nr = s.rows.size(), nc = s.cols.size();
+#pragma omp parallel for collapse(2) schedule(dynamic, 16)
+  for (int64_t i = 0; i < nr; i++) {
+    for (int64_t j = 0; j < nc; j++) {
+      s.ref[i * nc + j] =
+          reference_dot(n, k, a, b, transposed, s.rows[i], s.cols[j]);
+    }
+  }
+  return s;
+}
+
+// Reference for one full output row: `row` against all `n` columns.
+static std::vector<double> reference_row(int64_t n, int64_t k, float const *a,
+                                         float const *b, bool transposed,
+                                         int64_t row) {
+  std::vector<double> out(n);
+#pragma omp parallel for schedule(static)
+  for (int64_t col = 0; col < n; col++)
+    out[col] = reference_dot(n, k, a, b, transposed, row, col);
+  return out;
+}
+
+struct VerifyResult {
+  bool checked = false;
+  bool ok = true;
+  double max_abs = 0;
+  double max_rel = 0;
+  double tolerance = 0;
+};
+
+// Relative error against the reference; `got(row, col)` reads the engine's
+// output.
+template <typename Get>
+static VerifyResult check_sample(VerifySample const &s, Get &&got,
+                                 double tolerance) {
+  VerifyResult v;
+  v.checked = true;
+  v.tolerance = tolerance;
+  int64_t nc = s.cols.size();
+  bool nan = false;
+  for (size_t i = 0; i < s.rows.size(); i++) {
+    for (int64_t j = 0; j < nc; j++) {
+      double ref = s.ref[i * nc + j];
+      double err = std::fabs((double)got(s.rows[i], s.cols[j]) - ref);
+      nan |= std::isnan(err);
+      v.max_abs = std::max(v.max_abs, err);
+      v.max_rel = std::max(v.max_rel, err / std::max(std::fabs(ref), 1e-12));
+    }
+  }
+  // std::max drops NaNs, so they are tracked separately.
+  v.ok = !nan && v.max_rel <= tolerance;
+  return v;
+}
+
+// Default tolerances on the max relative error, by compute precision.
+static constexpr double VERIFY_TOL_F32 = 1e-4;
+static constexpr double VERIFY_TOL_BF16 = 2e-2;
+static constexpr double VERIFY_TOL_INT8 = 5e-2;